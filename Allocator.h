@@ -0,0 +1,111 @@
+#ifndef allocator_h_included
+#define allocator_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Allocator.h directly."
+#endif
+
+#include <algorithm>
+#include <new>
+
+namespace rodb
+{
+
+// Where a Database gets the memory for its blob when it owns a copy.  Databases keep a pointer
+// to the allocator, it has to outlive them.  May throw std::bad_alloc or std::runtime_error.
+class Allocator
+{
+public:
+	virtual ~Allocator()
+	{
+	}
+
+	virtual void *allocate(size_t size) = 0;
+	virtual void deallocate(void *memory, size_t size) = 0;
+
+	// The global heap, used when no allocator is given
+	static Allocator &heap();
+};
+
+class HeapAllocator: public Allocator
+{
+public:
+	virtual void *allocate(size_t size)
+	{
+		return ::operator new(size);
+	}
+
+	virtual void deallocate(void *memory, size_t)
+	{
+		::operator delete(memory);
+	}
+};
+
+inline Allocator &Allocator::heap()
+{
+	static HeapAllocator heap;
+	return heap;
+}
+
+// Hands out a region owned by the caller front to back, for example a pool reserved for all the
+// databases of a level.  Only the last block can be given back, reset reclaims everything.
+class Arena: public Allocator
+{
+public:
+	enum
+	{
+		ALIGNMENT = 16,
+	};
+
+	Arena(void *memory, size_t size): begin_(static_cast<char *>(memory)), end_(begin_ + size), top_(begin_)
+	{
+	}
+
+	virtual void *allocate(size_t size)
+	{
+		rodb_assert_or_throw(size <= static_cast<size_t>(end_ - top_), "Arena is out of memory");
+
+		void *memory = top_;
+		top_ += std::min(aligned(size), static_cast<size_t>(end_ - top_));
+		return memory;
+	}
+
+	virtual void deallocate(void *memory, size_t size)
+	{
+		char *block = static_cast<char *>(memory);
+		if (block + std::min(aligned(size), static_cast<size_t>(end_ - block)) == top_)
+			top_ = block;
+	}
+
+	void reset()
+	{
+		top_ = begin_;
+	}
+
+	size_t used() const
+	{
+		return top_ - begin_;
+	}
+
+	size_t capacity() const
+	{
+		return end_ - begin_;
+	}
+
+private:
+	static size_t aligned(size_t size)
+	{
+		return (size + ALIGNMENT - 1) & ~static_cast<size_t>(ALIGNMENT - 1);
+	}
+
+	char *const begin_;
+	char *const end_;
+	char *top_;
+
+	Arena(Arena const &);
+	Arena &operator =(Arena const &);
+};
+
+}
+
+#endif
@@ -0,0 +1,1829 @@
+#ifndef compiler_h_included
+#define compiler_h_included
+
+// The compiler is not a part of the run-time library.  It depends on libyaml and should be
+// linked with -lyaml.
+
+#include "rodb.h"
+
+#include <yaml.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace rodb
+{
+
+// Converts YAML into the rodb binary format.  Produces exactly the same output as rodb.rb.
+//
+// The input is parsed into a flat node table first.  After that the size of the blob is known
+// and it's written out depth first in a single pass, either into a pre-sized buffer or into a
+// file, without building any intermediate strings.
+//
+// With deduplication identical nodes are merged while parsing, so every distinct string or
+// subtree ends up in the node table once.  Before writing, every node is placed where it's first
+// met in depth first order, all the other references point back to that copy.
+//
+// With a profile the nodes on the hot paths are placed first and the cold subtrees hanging off
+// them are put aside and placed after the root, in the order they were met.
+//
+// Arrays at the indexed paths are indexed when they're closed, an alias of one shares the index.
+//
+// With the columnar option arrays of maps with the same keys become tables as soon as they're
+// closed.  A table node is a map from the keys to the columns, the columns are arrays themselves
+// and get packed, deduplicated or turned into tables like any other array.
+class Compiler
+{
+public:
+	struct Statistics
+	{
+		size_t nodes;
+		size_t input_size;
+		size_t output_size;
+		size_t duplicates;  // Values replaced with a reference to an identical one
+		size_t saved_bytes; // How much smaller the blob is compared to the one without deduplication
+		double parse_seconds;
+		double write_seconds;
+	};
+
+	struct Options
+	{
+		Options(): hash_maps(false), eytzinger_maps(false), dedup(false), patch(false), columnar(false), version(Database::Header::VERSION)
+		{
+		}
+
+		bool hash_maps;      // Emit a hash table for every non-empty map to speed up key lookups
+		bool eytzinger_maps; // Emit the key prefixes of every non-empty map in Eytzinger order
+		bool dedup;          // Store identical strings and subtrees only once
+		bool patch;          // Null map values delete the key from the layers below, see Overlay
+		bool columnar;       // Store arrays of maps with the same keys column by column, see Value::is_table
+		uint32_t version;    // Format version, 1 is readable by older readers but has no inline scalars
+
+		// Hot paths like "ball.start_position.x" and their weights, see load_profile.  The paths
+		// with a weight and their ancestors are written before everything else.
+		std::map<std::string, uint64_t> profile;
+
+		// Paths of arrays of maps like "items" and the fields to index them by, see Value::find_by
+		std::map<std::string, std::vector<std::string> > indexes;
+	};
+
+	// Reads the output of Profile::dump or lines of "weight path", only the first and the last
+	// column are used.  Other lines are skipped.
+	static std::map<std::string, uint64_t> load_profile(std::istream &in)
+	{
+		std::map<std::string, uint64_t> profile;
+		std::string line;
+		while (std::getline(in, line))
+		{
+			std::istringstream fields(line);
+			std::string weight;
+			std::string path;
+			std::string field;
+			fields >> weight;
+			while (fields >> field)
+				path = field;
+
+			if (weight.empty() || path.empty() || weight.find_first_not_of("0123456789") != std::string::npos)
+				continue;
+
+			profile[path == "(root)" ? "" : path] += strtoull(weight.c_str(), 0, 10);
+		}
+
+		return profile;
+	}
+
+	explicit Compiler(Options const &options = Options()):
+		options_(options),
+		unique_nodes_(0, NodeHash(*this), NodeEqual(*this)),
+		indexes_(1),
+		placed_size_(0),
+		root_(INVALID_NODE)
+	{
+		memset(&statistics_, 0, sizeof(statistics_));
+	}
+
+	void parse(char const *yaml)
+	{
+		parse(yaml, strlen(yaml));
+	}
+
+	void parse(char const *yaml, size_t size)
+	{
+		Timer timer;
+		Parser(*this).parse(yaml, size);
+		place();
+
+		statistics_.nodes = nodes_.size();
+		statistics_.input_size = size;
+		statistics_.output_size = this->size();
+		statistics_.parse_seconds = timer.seconds();
+	}
+
+	void parse_file(char const *filename)
+	{
+		std::ifstream in(filename, std::ios::binary);
+		if (in.fail())
+			throw std::runtime_error("Cannot open input file");
+
+		std::vector<char> yaml((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		parse(yaml.empty() ? "" : &yaml[0], yaml.size());
+	}
+
+	// Size of the compiled blob, known as soon as the input is parsed
+	size_t size() const
+	{
+		rodb_assert_or_throw(root_ != INVALID_NODE, "Nothing to compile");
+		return placing() ? placed_size_ : sizeof(Database::Header) + nodes_[root_].size;
+	}
+
+	// The buffer must be at least size() bytes long
+	void write(char *buffer, size_t size) const
+	{
+		rodb_assert_or_throw(size >= this->size(), "Output buffer is too small");
+
+		Timer timer;
+		BufferSink sink(buffer);
+		write(sink);
+		statistics_.write_seconds = timer.seconds();
+	}
+
+	void write(std::vector<char> &blob) const
+	{
+		blob.resize(size());
+		write(&blob[0], blob.size());
+	}
+
+	void write_file(char const *filename) const
+	{
+		Timer timer;
+		FileSink sink(filename);
+		write(sink);
+		sink.close();
+		statistics_.write_seconds = timer.seconds();
+	}
+
+	Statistics const &statistics() const
+	{
+		return statistics_;
+	}
+
+private:
+	enum
+	{
+		INVALID_NODE = 0xffffffff,
+		MERGE_KEY = 0, // Not a real type, "<<" in a map key position
+		TABLE = Value::ARRAY | Value::MAP << 8, // The type word of tables, see add_table
+		NODE_HEADER_SIZE = 8,
+		INLINE_SIZE = 4,
+	};
+
+	struct Node
+	{
+		uint32_t type;  // Value::Type
+		uint32_t count; // Compounds: number of elements (keys of tables), strings: length without the terminator
+		uint32_t first; // Compounds: index into children_, strings: index into strings_, other scalars: the bits
+		uint32_t size;  // Size of the encoded value including the header, without deduplication
+		uint32_t index; // Arrays and tables: the fields they're indexed by in indexes_, 0 for none
+	};
+
+	// Where a node goes when deduplicating or following a profile
+	struct Placement
+	{
+		uint32_t position;  // From the beginning of the blob
+		uint32_t size;      // The node and everything placed inside of it
+		uint32_t keys_size; // Maps and tables only, same for the keys array
+	};
+
+	class NodeHash
+	{
+	public:
+		explicit NodeHash(Compiler const &compiler): compiler_(&compiler)
+		{
+		}
+
+		size_t operator ()(uint32_t index) const
+		{
+			return compiler_->node_hash(index);
+		}
+
+	private:
+		Compiler const *compiler_;
+	};
+
+	class NodeEqual
+	{
+	public:
+		explicit NodeEqual(Compiler const &compiler): compiler_(&compiler)
+		{
+		}
+
+		bool operator ()(uint32_t left, uint32_t right) const
+		{
+			return compiler_->node_equal(left, right);
+		}
+
+	private:
+		Compiler const *compiler_;
+	};
+
+	class Timer
+	{
+	public:
+		Timer(): start_(std::chrono::steady_clock::now())
+		{
+		}
+
+		double seconds() const
+		{
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+		}
+
+	private:
+		std::chrono::steady_clock::time_point start_;
+	};
+
+	//
+	// Parsing
+	//
+
+	class Parser
+	{
+	public:
+		explicit Parser(Compiler &compiler): compiler_(compiler)
+		{
+			memset(&parser_, 0, sizeof(parser_));
+			memset(&event_, 0, sizeof(event_));
+		}
+
+		~Parser()
+		{
+			yaml_event_delete(&event_);
+			yaml_parser_delete(&parser_);
+		}
+
+		void parse(char const *yaml, size_t size)
+		{
+			compiler_.nodes_.clear();
+			compiler_.children_.clear();
+			compiler_.strings_.clear();
+			compiler_.unique_nodes_.clear();
+			compiler_.indexes_.resize(1);
+			compiler_.root_ = INVALID_NODE;
+
+			if (!yaml_parser_initialize(&parser_))
+				throw std::bad_alloc();
+
+			yaml_parser_set_input_string(&parser_, reinterpret_cast<unsigned char const *>(yaml), size);
+
+			bool done = false;
+			while (!done)
+			{
+				yaml_event_delete(&event_);
+				if (!yaml_parser_parse(&parser_, &event_))
+					fail(parser_.problem ? parser_.problem : "Invalid YAML", parser_.problem_mark);
+
+				switch (event_.type)
+				{
+				case YAML_SEQUENCE_START_EVENT:
+					check_collection_tag(event_.data.sequence_start.tag, "tag:yaml.org,2002:seq");
+					open(Value::ARRAY, event_.data.sequence_start.anchor);
+					break;
+
+				case YAML_MAPPING_START_EVENT:
+					check_collection_tag(event_.data.mapping_start.tag, "tag:yaml.org,2002:map");
+					open(Value::MAP, event_.data.mapping_start.anchor);
+					break;
+
+				case YAML_SEQUENCE_END_EVENT:
+				case YAML_MAPPING_END_EVENT:
+					close();
+					break;
+
+				case YAML_SCALAR_EVENT:
+					add(scalar(), reinterpret_cast<char const *>(event_.data.scalar.anchor));
+					break;
+
+				case YAML_ALIAS_EVENT:
+					add(alias(), 0);
+					break;
+
+				// Only the first document is compiled, just like YAML::load does it
+				case YAML_DOCUMENT_END_EVENT:
+				case YAML_STREAM_END_EVENT:
+					done = true;
+					break;
+
+				default:
+					break;
+				}
+			}
+
+			uint32_t root = compiler_.root_;
+			if (root == INVALID_NODE || !is_compound(compiler_.nodes_[root]))
+				throw std::runtime_error("Root object must be either array or map");
+		}
+
+	private:
+		struct Frame
+		{
+			uint32_t type;
+			size_t first_pending;
+			std::string anchor;
+			yaml_mark_t mark;
+		};
+
+		struct Pair
+		{
+			uint32_t key;
+			uint32_t value;
+			size_t order;
+		};
+
+		class PairLess
+		{
+		public:
+			explicit PairLess(Compiler const &compiler): compiler_(compiler)
+			{
+			}
+
+			bool operator ()(Pair const &left, Pair const &right) const
+			{
+				int const cmp = compiler_.compare_strings(left.key, right.key);
+				return cmp < 0 || (cmp == 0 && left.order < right.order);
+			}
+
+		private:
+			Compiler const &compiler_;
+		};
+
+		void open(uint32_t type, yaml_char_t const *anchor)
+		{
+			Frame frame;
+			frame.type = type;
+			frame.first_pending = pending_.size();
+			frame.anchor = anchor ? reinterpret_cast<char const *>(anchor) : "";
+			frame.mark = event_.start_mark;
+			stack_.push_back(frame);
+		}
+
+		void close()
+		{
+			Frame const frame = stack_.back();
+			stack_.pop_back();
+
+			uint32_t const *items = pending_.empty() ? 0 : &pending_[0] + frame.first_pending;
+			size_t const count = pending_.size() - frame.first_pending;
+
+			uint32_t const node = frame.type == Value::ARRAY
+				? compiler_.add_sequence(items, count, index_fields(frame.first_pending))
+				: add_map(items, count, frame.mark);
+
+			pending_.resize(frame.first_pending);
+			add(node, frame.anchor.empty() ? 0 : frame.anchor.c_str());
+		}
+
+		// The fields to index the array being closed by, or 0.  Its items start at end in pending_.
+		// The path is made the way rodb.rb and Profile make it, the values merged with "<<" get the
+		// paths of the map they're merged into.
+		uint32_t index_fields(size_t end) const
+		{
+			// Version 1 readers don't know the flag
+			if (compiler_.options_.indexes.empty() || compiler_.options_.version < 2)
+				return 0;
+
+			std::string path;
+			bool merging = false;
+			for (size_t i = 0; i < stack_.size(); ++i)
+			{
+				Frame const &frame = stack_[i];
+				size_t const child = i + 1 < stack_.size() ? stack_[i + 1].first_pending : end;
+				if (frame.type == Value::ARRAY)
+				{
+					if (!merging)
+						path += '[' + std::to_string(child - frame.first_pending) + ']';
+					continue;
+				}
+
+				// Keys don't have paths
+				if ((child - frame.first_pending) % 2 == 0)
+					return 0;
+
+				uint32_t const key = pending_[child - 1];
+				merging = compiler_.nodes_[key].type == MERGE_KEY;
+				if (merging)
+					continue;
+
+				if (compiler_.nodes_[key].type != Value::STRING)
+					return 0;
+
+				if (!path.empty())
+					path += '.';
+				path.append(compiler_.string_data(key), compiler_.nodes_[key].count);
+			}
+
+			std::map<std::string, std::vector<std::string> >::const_iterator const fields = compiler_.options_.indexes.find(path);
+			if (fields == compiler_.options_.indexes.end() || fields->second.empty())
+				return 0;
+
+			compiler_.indexes_.push_back(fields->second);
+			return static_cast<uint32_t>(compiler_.indexes_.size() - 1);
+		}
+
+		uint32_t add_map(uint32_t const *items, size_t count, yaml_mark_t const &mark)
+		{
+			// Collect the pairs in the source order, "<<" merges are expanded in place.  Later
+			// pairs override earlier ones, just like Hash#merge! does it.
+			std::vector<Pair> pairs;
+			pairs.reserve(count / 2);
+			for (size_t i = 0; i < count; i += 2)
+			{
+				uint32_t key = items[i];
+				uint32_t value = items[i + 1];
+
+				if (compiler_.nodes_[key].type == MERGE_KEY)
+				{
+					if (merge(pairs, value))
+						continue;
+
+					key = compiler_.add_string("<<", 2);
+				}
+
+				if (compiler_.nodes_[key].type != Value::STRING)
+					fail("Map keys should be strings", mark);
+
+				add_pair(pairs, key, value);
+			}
+
+			// Sort by key, the last one wins among duplicates
+			std::sort(pairs.begin(), pairs.end(), PairLess(compiler_));
+
+			std::vector<uint32_t> sorted;
+			sorted.reserve(pairs.size() * 2);
+			for (size_t i = 0; i < pairs.size(); ++i)
+			{
+				if (i + 1 < pairs.size() && compiler_.compare_strings(pairs[i].key, pairs[i + 1].key) == 0)
+					continue;
+
+				sorted.push_back(pairs[i].key);
+				sorted.push_back(pairs[i].value);
+			}
+
+			return compiler_.add_map(sorted.empty() ? 0 : &sorted[0], sorted.size() / 2);
+		}
+
+		void add_pair(std::vector<Pair> &pairs, uint32_t key, uint32_t value)
+		{
+			Pair pair = {key, value, pairs.size()};
+			pairs.push_back(pair);
+		}
+
+		// Returns false when the value can't be merged and "<<" should be treated as a regular key
+		bool merge(std::vector<Pair> &pairs, uint32_t value)
+		{
+			Node const &node = compiler_.nodes_[value];
+			if (node.type == Value::MAP)
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+					add_pair(pairs, compiler_.children_[node.first + 2 * i], compiler_.children_[node.first + 2 * i + 1]);
+
+				return true;
+			}
+
+			if (node.type == Value::ARRAY)
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+					if (compiler_.nodes_[compiler_.children_[node.first + i]].type != Value::MAP)
+						return false;
+
+				// Earlier maps take precedence
+				for (uint32_t i = node.count; i > 0; --i)
+					merge(pairs, compiler_.children_[node.first + i - 1]);
+
+				return true;
+			}
+
+			// The rows are kept after the columns
+			if (node.type == TABLE)
+			{
+				for (uint32_t i = compiler_.rows(node); i > 0; --i)
+					merge(pairs, compiler_.children_[node.first + 2 * node.count + i - 1]);
+
+				return true;
+			}
+
+			return false;
+		}
+
+		void add(uint32_t node, char const *anchor)
+		{
+			if (anchor)
+				anchors_[anchor] = node;
+
+			if (stack_.empty())
+			{
+				compiler_.root_ = node;
+				return;
+			}
+
+			if (compiler_.nodes_[node].type == Value::DELETED && stack_.back().type != Value::MAP)
+				fail("Deletions are only allowed as map values", event_.start_mark);
+
+			// Only keys can be merge keys
+			if (compiler_.nodes_[node].type == MERGE_KEY && (stack_.back().type != Value::MAP || (pending_.size() - stack_.back().first_pending) % 2 != 0))
+				node = compiler_.add_string("<<", 2);
+
+			pending_.push_back(node);
+		}
+
+		uint32_t alias()
+		{
+			std::map<std::string, uint32_t>::const_iterator i = anchors_.find(reinterpret_cast<char const *>(event_.data.alias.anchor));
+			if (i == anchors_.end())
+				fail("Unknown alias", event_.start_mark);
+
+			return i->second;
+		}
+
+		uint32_t scalar()
+		{
+			char const *value = reinterpret_cast<char const *>(event_.data.scalar.value);
+			size_t const length = event_.data.scalar.length;
+			char const *tag = reinterpret_cast<char const *>(event_.data.scalar.tag);
+
+			if (tag)
+			{
+				if (strcmp(tag, "tag:yaml.org,2002:str") == 0 || strcmp(tag, "!") == 0)
+					return compiler_.add_string(value, length);
+
+				fail("Unsupported tag", event_.start_mark);
+			}
+
+			if (event_.data.scalar.style != YAML_PLAIN_SCALAR_STYLE)
+			{
+				if (length == 2 && memcmp(value, "<<", 2) == 0)
+					return compiler_.add_node(MERGE_KEY, 0, 0, 0);
+
+				return compiler_.add_string(value, length);
+			}
+
+			return resolve(value, length);
+		}
+
+		// Plain scalar type resolution, follows Psych::ScalarScanner
+		uint32_t resolve(char const *value, size_t length)
+		{
+			std::string const s(value, length);
+
+			if (s.empty() || s == "~" || lower(s) == "null")
+			{
+				if (!compiler_.options_.patch)
+					fail("Unsupported type NilClass", event_.start_mark);
+
+				return compiler_.add_scalar(Value::DELETED, 0);
+			}
+
+			if (s == "<<")
+				return compiler_.add_node(MERGE_KEY, 0, 0, 0);
+
+			std::string const l = lower(s);
+			if (l == "yes" || l == "true" || l == "on")
+				return compiler_.add_scalar(Value::BOOL, 1);
+
+			if (l == "no" || l == "false" || l == "off")
+				return compiler_.add_scalar(Value::BOOL, 0);
+
+			if (is_date(s))
+				fail("Unsupported type Time", event_.start_mark);
+
+			if (s.size() > 1 && s[0] == ':')
+				fail("Unsupported type Symbol", event_.start_mark);
+
+			if (l == ".inf" || l == "+.inf")
+				return add_float(std::numeric_limits<double>::infinity());
+
+			if (l == "-.inf")
+				return add_float(-std::numeric_limits<double>::infinity());
+
+			if (l == ".nan")
+				return add_float(std::numeric_limits<double>::quiet_NaN());
+
+			int64_t i;
+			if (is_sexagesimal(s, i))
+				return add_int(i);
+
+			if (is_float(s))
+				return add_float(strtod(strip(s, "_,").c_str(), 0));
+
+			if (is_int(s, i))
+				return add_int(i);
+
+			return compiler_.add_string(value, length);
+		}
+
+		uint32_t add_int(int64_t value)
+		{
+			// pack('V') keeps the lower 32 bits
+			return compiler_.add_scalar(Value::INT, static_cast<uint32_t>(value));
+		}
+
+		uint32_t add_float(double value)
+		{
+			float const f = static_cast<float>(value);
+			uint32_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			return compiler_.add_scalar(Value::FLOAT, bits);
+		}
+
+		static std::string lower(std::string s)
+		{
+			for (size_t i = 0; i < s.size(); ++i)
+				s[i] = static_cast<char>(tolower(static_cast<unsigned char>(s[i])));
+
+			return s;
+		}
+
+		static std::string strip(std::string const &s, char const *chars)
+		{
+			std::string result;
+			result.reserve(s.size());
+			for (size_t i = 0; i < s.size(); ++i)
+				if (!strchr(chars, s[i]))
+					result += s[i];
+
+			return result;
+		}
+
+		static size_t digits(std::string const &s, size_t i, char const *allowed)
+		{
+			size_t start = i;
+			while (i < s.size() && strchr(allowed, s[i]))
+				++i;
+
+			return i - start;
+		}
+
+		static size_t sign(std::string const &s)
+		{
+			return !s.empty() && (s[0] == '-' || s[0] == '+') ? 1 : 0;
+		}
+
+		// \d{4}-\d{1,2}-\d{1,2} followed by the end or a time
+		static bool is_date(std::string const &s)
+		{
+			size_t i = s[0] == '-' ? 1 : 0;
+			if (digits(s, i, "0123456789") != 4 || s.size() <= i + 4 || s[i + 4] != '-')
+				return false;
+
+			i += 5;
+			size_t n = digits(s, i, "0123456789");
+			if (n < 1 || n > 2 || s.size() <= i + n || s[i + n] != '-')
+				return false;
+
+			i += n + 1;
+			n = digits(s, i, "0123456789");
+			if (n < 1 || n > 2)
+				return false;
+
+			i += n;
+			return i == s.size() || s[i] == 'T' || s[i] == 't' || s[i] == ' ' || s[i] == '\t';
+		}
+
+		// [-+]?[0-9][0-9_]*(:[0-5]?[0-9]){1,2}, the groups are weighted exactly the way Psych
+		// does it: 60^|index - 2|, so "1:30" is 5400.
+		static bool is_sexagesimal(std::string const &s, int64_t &value)
+		{
+			size_t i = sign(s);
+			size_t n = digits(s, i, "0123456789_");
+			if (n == 0 || s[i] == '_')
+				return false;
+
+			std::vector<int64_t> groups(1, strtoll(strip(s.substr(0, i + n), "_").c_str(), 0, 10));
+			i += n;
+
+			while (i < s.size() && s[i] == ':')
+			{
+				n = digits(s, ++i, "0123456789");
+				if (n < 1 || n > 2 || (n == 2 && s[i] > '5'))
+					return false;
+
+				groups.push_back(strtoll(s.substr(i, n).c_str(), 0, 10));
+				i += n;
+			}
+
+			if (i != s.size() || groups.size() < 2 || groups.size() > 3)
+				return false;
+
+			value = 0;
+			for (size_t e = 0; e < groups.size(); ++e)
+			{
+				int64_t weight = 1;
+				for (size_t k = 0; k < (e > 2 ? e - 2 : 2 - e); ++k)
+					weight *= 60;
+
+				value += groups[e] * weight;
+			}
+
+			return true;
+		}
+
+		// [-+]?([0-9][0-9_,]*)?\.[0-9]*([eE][-+][0-9]+)?
+		static bool is_float(std::string const &s)
+		{
+			size_t i = sign(s);
+			size_t const start = i;
+			if (i < s.size() && isdigit(static_cast<unsigned char>(s[i])))
+				i += digits(s, i, "0123456789_,");
+
+			if (i >= s.size() || s[i] != '.')
+				return false;
+
+			// "." and "+." are strings
+			if (i == start && i + 1 == s.size())
+				return false;
+
+			i += 1 + digits(s, i + 1, "0123456789");
+
+			if (i < s.size() && (s[i] == 'e' || s[i] == 'E'))
+			{
+				if (i + 1 >= s.size() || (s[i + 1] != '-' && s[i + 1] != '+'))
+					return false;
+
+				size_t const n = digits(s, i + 2, "0123456789");
+				if (n == 0)
+					return false;
+
+				i += 2 + n;
+			}
+
+			return i == s.size();
+		}
+
+		// Binary, octal, decimal and hex with "_" and "," separators
+		bool is_int(std::string const &s, int64_t &value) const
+		{
+			size_t i = sign(s);
+			if (i >= s.size())
+				return false;
+
+			int base = 10;
+			size_t first_digit = i;
+			char const *allowed = "0123456789";
+			if (s.compare(i, 2, "0b") == 0)
+			{
+				base = 2;
+				first_digit += 2;
+				allowed = "01_,";
+			}
+			else if (s.compare(i, 2, "0x") == 0)
+			{
+				base = 16;
+				first_digit += 2;
+				allowed = "0123456789abcdefABCDEF_,";
+			}
+			else if (s[i] == '0' && i + 1 < s.size())
+			{
+				base = 8;
+				first_digit += 1;
+				allowed = "01234567_,";
+			}
+			else if (s[i] != '0')
+			{
+				// Separators are only allowed between digits
+				if (!isdigit(static_cast<unsigned char>(s[i])))
+					return false;
+
+				for (size_t j = i + 1; j < s.size(); ++j)
+				{
+					if ((s[j] == '_' || s[j] == ',') && j + 1 < s.size() && isdigit(static_cast<unsigned char>(s[j + 1])))
+						++j;
+					else if (!isdigit(static_cast<unsigned char>(s[j])))
+						return false;
+				}
+
+				allowed = "0123456789_,";
+			}
+
+			if (first_digit >= s.size() || digits(s, first_digit, allowed) != s.size() - first_digit)
+				return false;
+
+			std::string const number = strip(s.substr(first_digit), "_,");
+			if (number.empty())
+				return false;
+
+			errno = 0;
+			unsigned long long const magnitude = strtoull(number.c_str(), 0, base);
+			if (errno == ERANGE || magnitude > static_cast<unsigned long long>(std::numeric_limits<int64_t>::max()))
+				fail("Integer is out of range", event_.start_mark);
+
+			value = s[0] == '-' ? -static_cast<int64_t>(magnitude) : static_cast<int64_t>(magnitude);
+			return true;
+		}
+
+		void check_collection_tag(yaml_char_t const *tag, char const *allowed)
+		{
+			if (tag && strcmp(reinterpret_cast<char const *>(tag), allowed) != 0)
+				fail("Unsupported tag", event_.start_mark);
+		}
+
+		void fail(char const *message, yaml_mark_t const &mark) const
+		{
+			std::ostringstream s;
+			s << message << " (line " << mark.line + 1 << ", column " << mark.column + 1 << ")";
+			throw std::runtime_error(s.str());
+		}
+
+		Compiler &compiler_;
+		yaml_parser_t parser_;
+		yaml_event_t event_;
+		std::vector<Frame> stack_;
+		std::vector<uint32_t> pending_;
+		std::map<std::string, uint32_t> anchors_;
+	};
+
+	uint32_t add_node(uint32_t type, uint32_t count, uint32_t first, size_t size, uint32_t fields = 0)
+	{
+		if (size > 0xffffffffu - sizeof(Database::Header))
+			throw std::runtime_error("Database is too large");
+
+		Node node = {type, count, first, static_cast<uint32_t>(size), fields};
+		nodes_.push_back(node);
+		uint32_t const index = static_cast<uint32_t>(nodes_.size() - 1);
+
+		if (!options_.dedup)
+			return index;
+
+		// Drop the new node if there's an identical one already
+		std::pair<std::unordered_set<uint32_t, NodeHash, NodeEqual>::iterator, bool> const unique = unique_nodes_.insert(index);
+		if (unique.second)
+			return index;
+
+		if (type == Value::STRING)
+			strings_.resize(first);
+		else if (is_compound(nodes_.back()))
+			children_.resize(first);
+
+		nodes_.pop_back();
+		return *unique.first;
+	}
+
+	size_t node_hash(uint32_t index) const
+	{
+		Node const &node = nodes_[index];
+		uint32_t hash = Key::hash(reinterpret_cast<char const *>(&node.type), sizeof(node.type));
+		switch (node.type)
+		{
+		case Value::STRING:
+			return hash ^ hash_string(index);
+
+		case Value::ARRAY:
+		case Value::MAP:
+		case TABLE:
+			return hash ^ Key::hash(reinterpret_cast<char const *>(children(node)), items(node) * sizeof(uint32_t));
+
+		default:
+			return hash ^ node.first;
+		}
+	}
+
+	bool node_equal(uint32_t left, uint32_t right) const
+	{
+		Node const &l = nodes_[left];
+		Node const &r = nodes_[right];
+		if (l.type != r.type || l.count != r.count || indexes_[l.index] != indexes_[r.index])
+			return false;
+
+		switch (l.type)
+		{
+		case Value::STRING:
+			return compare_strings(left, right) == 0;
+
+		case Value::ARRAY:
+		case Value::MAP:
+		case TABLE:
+			return std::equal(children(l), children(l) + items(l), children(r));
+
+		default:
+			return l.first == r.first;
+		}
+	}
+
+	uint32_t const *children(Node const &node) const
+	{
+		return children_.empty() ? 0 : &children_[0] + node.first;
+	}
+
+	static bool is_compound(Node const &node)
+	{
+		return node.type == Value::ARRAY || node.type == Value::MAP || node.type == TABLE;
+	}
+
+	// Children of a compound: the elements, the key/value pairs or the key/column pairs.  The rows
+	// of a table follow its pairs, but they're only used to merge it.
+	static size_t items(Node const &node)
+	{
+		return node.type == Value::ARRAY ? node.count : 2 * node.count;
+	}
+
+	// Tables only, all the columns are as long as the table
+	uint32_t rows(Node const &table) const
+	{
+		Node const &column = nodes_[children_[table.first + 1]];
+		return column.type == TABLE ? rows(column) : column.count;
+	}
+
+	// Bools, ints, floats and deletions
+	uint32_t add_scalar(uint32_t type, uint32_t bits)
+	{
+		return add_node(type, 0, bits, is_inline(type, 0, bits) ? INLINE_SIZE : NODE_HEADER_SIZE + 4);
+	}
+
+	uint32_t add_string(char const *value, size_t length)
+	{
+		uint32_t const first = static_cast<uint32_t>(strings_.size());
+		strings_.insert(strings_.end(), value, value + length);
+		size_t const size = is_inline(Value::STRING, length, 0) ? INLINE_SIZE : NODE_HEADER_SIZE + length + 1;
+		return add_node(Value::STRING, static_cast<uint32_t>(length), first, size);
+	}
+
+	// Format v2 keeps small scalars in the type word, see Value::is_inline
+	bool is_inline(uint32_t type, size_t length, uint32_t bits) const
+	{
+		if (options_.version < 2)
+			return false;
+
+		switch (type)
+		{
+		case Value::BOOL:
+		case Value::DELETED:
+			return true;
+
+		case Value::INT:
+			{
+				int32_t const value = static_cast<int32_t>(bits);
+				return value >= -(1 << 23) && value < (1 << 23);
+			}
+
+		case Value::FLOAT:
+			return (bits & Value::TAG_MASK) == 0;
+
+		case Value::STRING:
+			return length <= Value::INLINE_STRING_LENGTH;
+
+		default:
+			return false;
+		}
+	}
+
+	bool is_inline(Node const &node) const
+	{
+		return is_inline(node.type, node.count, node.first);
+	}
+
+	// Packed arrays are never indexed
+	uint32_t add_array(uint32_t const *items, size_t count, uint32_t index = 0)
+	{
+		uint32_t const first = static_cast<uint32_t>(children_.size());
+		children_.insert(children_.end(), items, items + count);
+		if (packed_type(first, count, 1) != 0)
+			index = 0;
+
+		return add_node(Value::ARRAY, static_cast<uint32_t>(count), first,
+			array_size(first, count, 1) + index_size(items, count, index, Value::ARRAY), index);
+	}
+
+	// The pairs must be sorted by key
+	uint32_t add_map(uint32_t const *pairs, size_t count)
+	{
+		uint32_t const first = static_cast<uint32_t>(children_.size());
+		children_.insert(children_.end(), pairs, pairs + count * 2);
+		return add_node(Value::MAP, static_cast<uint32_t>(count), first, map_size(first, count));
+	}
+
+	// Arrays and tables
+	uint32_t add_sequence(uint32_t const *items, size_t count, uint32_t index = 0)
+	{
+		return is_table(items, count) ? add_table(items, count, index) : add_array(items, count, index);
+	}
+
+	// Two or more maps with the same non-empty set of keys
+	bool is_table(uint32_t const *items, size_t count) const
+	{
+		if (!options_.columnar || options_.patch || options_.version < 2 || count < 2)
+			return false;
+
+		Node const &schema = nodes_[items[0]];
+		if (schema.type != Value::MAP || schema.count == 0)
+			return false;
+
+		for (size_t i = 1; i < count; ++i)
+		{
+			Node const &row = nodes_[items[i]];
+			if (row.type != Value::MAP || row.count != schema.count)
+				return false;
+
+			for (uint32_t j = 0; j < schema.count; ++j)
+				if (compare_strings(children_[schema.first + 2 * j], children_[row.first + 2 * j]) != 0)
+					return false;
+		}
+
+		return true;
+	}
+
+	// Laid out like a map of the keys to the columns, with the number of rows in place of the
+	// number of keys
+	uint32_t add_table(uint32_t const *maps, size_t count, uint32_t index)
+	{
+		Node const schema = nodes_[maps[0]];
+		std::vector<uint32_t> pairs(2 * schema.count);
+		std::vector<uint32_t> column(count);
+		for (uint32_t j = 0; j < schema.count; ++j)
+		{
+			for (size_t i = 0; i < count; ++i)
+				column[i] = children_[nodes_[maps[i]].first + 2 * j + 1];
+
+			pairs[2 * j] = children_[schema.first + 2 * j];
+			pairs[2 * j + 1] = add_sequence(&column[0], count);
+		}
+
+		uint32_t const first = static_cast<uint32_t>(children_.size());
+		children_.insert(children_.end(), pairs.begin(), pairs.end());
+		children_.insert(children_.end(), maps, maps + count);
+		return add_node(TABLE, schema.count, first, map_size(first, schema.count) + index_size(maps, count, index, TABLE), index);
+	}
+
+	size_t map_size(uint32_t first, size_t count) const
+	{
+		return NODE_HEADER_SIZE + 8 + array_size(first, count, 2) + array_size(first + 1, count, 2) + hash_table_size(count) + eytzinger_tree_size(count);
+	}
+
+	// The index sections of an indexed array or table, the array also ends with their size
+	size_t index_size(uint32_t const *rows, size_t count, uint32_t index, uint32_t type) const
+	{
+		if (index == 0)
+			return 0;
+
+		size_t size = type == TABLE ? 0 : 4;
+		std::vector<uint32_t> entries;
+		for (size_t i = 0; i < indexes_[index].size(); ++i)
+		{
+			std::string const &field = indexes_[index][i];
+			index_entries(rows, count, field, entries);
+			size += index_section_size(field, entries.size() / 2);
+		}
+
+		return size;
+	}
+
+	size_t index_size(Node const &node) const
+	{
+		return index_size(indexed_rows(node), indexed_count(node), node.index, node.type);
+	}
+
+	size_t index_section_size(std::string const &field, size_t count) const
+	{
+		return 8 + 4 + (field.size() + 3) / 4 * 4 + 4 + 8 * hash_slot_count(count);
+	}
+
+	// The elements of an array, the rows of a table follow its columns
+	uint32_t const *indexed_rows(Node const &node) const
+	{
+		return children(node) + (node.type == TABLE ? 2 * node.count : 0);
+	}
+
+	size_t indexed_count(Node const &node) const
+	{
+		return node.type == TABLE ? rows(node) : node.count;
+	}
+
+	// Hash and element index pairs of the rows that have an int or a string under the field, see
+	// Value::find_index
+	void index_entries(uint32_t const *rows, size_t count, std::string const &field, std::vector<uint32_t> &entries) const
+	{
+		entries.clear();
+		for (size_t i = 0; i < count; ++i)
+		{
+			Node const &row = nodes_[rows[i]];
+			if (row.type != Value::MAP)
+				continue;
+
+			for (uint32_t j = 0; j < row.count; ++j)
+			{
+				uint32_t const key = children_[row.first + 2 * j];
+				if (nodes_[key].count != field.size() || memcmp(string_data(key), field.data(), field.size()) != 0)
+					continue;
+
+				uint32_t const value = children_[row.first + 2 * j + 1];
+				Node const &v = nodes_[value];
+				if (v.type == Value::INT)
+				{
+					char const bytes[] = {
+						static_cast<char>(v.first),
+						static_cast<char>(v.first >> 8),
+						static_cast<char>(v.first >> 16),
+						static_cast<char>(v.first >> 24),
+					};
+					entries.push_back(Key::hash(bytes, sizeof(bytes)));
+					entries.push_back(static_cast<uint32_t>(i));
+				}
+				else if (v.type == Value::STRING)
+				{
+					entries.push_back(hash_string(value));
+					entries.push_back(static_cast<uint32_t>(i));
+				}
+
+				break;
+			}
+		}
+	}
+
+	uint32_t hash_slot_count(size_t count) const
+	{
+		uint32_t slot_count = 1;
+		while (slot_count < count * 2)
+			slot_count *= 2;
+
+		return slot_count;
+	}
+
+	size_t hash_table_size(size_t count) const
+	{
+		return options_.hash_maps && count > 0 ? 8 + 4 + 8 * hash_slot_count(count) : 0;
+	}
+
+	size_t eytzinger_tree_size(size_t count) const
+	{
+		return options_.eytzinger_maps && count > 0 ? 8 + 4 + 12 * count : 0;
+	}
+
+	// Fills order with positions of the sorted keys in a 1-based Eytzinger layout
+	static void eytzinger_order(std::vector<uint32_t> &order, size_t k, uint32_t &sorted_index)
+	{
+		if (k > order.size())
+			return;
+
+		eytzinger_order(order, 2 * k, sorted_index);
+		order[k - 1] = sorted_index++;
+		eytzinger_order(order, 2 * k + 1, sorted_index);
+	}
+
+	uint32_t hash_string(uint32_t index) const
+	{
+		return Key::hash(string_data(index), nodes_[index].count);
+	}
+
+	uint64_t string_prefix(uint32_t index) const
+	{
+		return Key::prefix(string_data(index), nodes_[index].count);
+	}
+
+	// Empty strings might leave the pool empty
+	char const *string_data(uint32_t index) const
+	{
+		return strings_.empty() ? "" : &strings_[0] + nodes_[index].first;
+	}
+
+	// Size of an array made of every stride-th child starting at first
+	size_t array_size(uint32_t first, size_t count, size_t stride) const
+	{
+		if (uint32_t const element_type = packed_type(first, count, stride))
+			return NODE_HEADER_SIZE + 4 + count * Value::packed_size(element_type);
+
+		size_t size = NODE_HEADER_SIZE + 4 + 4 * count;
+		for (size_t i = 0; i < count; ++i)
+			size += nodes_[children_[first + i * stride]].size;
+
+		return size;
+	}
+
+	// Format v2 packs non-empty arrays of only ints, only floats or only bools, see
+	// Value::is_packed.  Returns the element type or 0.
+	uint32_t packed_type(uint32_t first, size_t count, size_t stride) const
+	{
+		if (options_.version < 2 || count == 0)
+			return 0;
+
+		uint32_t const type = nodes_[children_[first]].type;
+		if (type != Value::BOOL && type != Value::INT && type != Value::FLOAT)
+			return 0;
+
+		for (size_t i = 1; i < count; ++i)
+			if (nodes_[children_[first + i * stride]].type != type)
+				return 0;
+
+		return type;
+	}
+
+	//
+	// Placing deduplicated nodes
+	//
+
+	// Nodes only need to be placed when they don't simply follow their parents
+	bool placing() const
+	{
+		return options_.dedup || !options_.profile.empty();
+	}
+
+	void place()
+	{
+		statistics_.duplicates = 0;
+		statistics_.saved_bytes = 0;
+
+		placements_.clear();
+		deferred_.clear();
+		hot_.clear();
+		if (!placing())
+			return;
+
+		std::string path;
+		std::string *hot_path = 0;
+		if (!options_.profile.empty())
+		{
+			if (!options_.dedup)
+				unshare();
+
+			add_hot_paths();
+			hot_path = &path;
+		}
+
+		Placement const unplaced = {INVALID_NODE, 0, 0};
+		placements_.assign(nodes_.size(), unplaced);
+		placed_size_ = place(root_, sizeof(Database::Header), hot_path);
+
+		for (size_t i = 0; i < deferred_.size(); ++i)
+			placed_size_ = place_child(deferred_[i], placed_size_, 0);
+	}
+
+	// Every profiled path with a weight and all of their prefixes, the root is always hot
+	void add_hot_paths()
+	{
+		hot_.insert("");
+		for (std::map<std::string, uint64_t>::const_iterator i = options_.profile.begin(); i != options_.profile.end(); ++i)
+		{
+			if (i->second == 0)
+				continue;
+
+			std::string const &path = i->first;
+			hot_.insert(path);
+			for (size_t j = 0; j < path.size(); ++j)
+				if (path[j] == '.' || path[j] == '[')
+					hot_.insert(path.substr(0, j));
+		}
+	}
+
+	// Aliases and merges share nodes.  A shared node is placed only once, so without
+	// deduplication every occurrence gets its own copy.
+	void unshare()
+	{
+		std::vector<bool> seen(nodes_.size(), false);
+		std::vector<uint32_t> stack(1, root_);
+		seen[root_] = true;
+		while (!stack.empty())
+		{
+			Node const node = nodes_[stack.back()];
+			stack.pop_back();
+			if (!is_compound(node))
+				continue;
+
+			for (size_t i = 0; i < items(node); ++i)
+			{
+				uint32_t const child = children_[node.first + i];
+				if (child >= seen.size())
+					continue;
+
+				if (seen[child])
+				{
+					uint32_t const copy = copy_node(child);
+					children_[node.first + i] = copy;
+				}
+				else
+				{
+					seen[child] = true;
+					stack.push_back(child);
+				}
+			}
+		}
+	}
+
+	uint32_t copy_node(uint32_t index)
+	{
+		Node node = nodes_[index];
+		if (is_compound(node))
+		{
+			// The rows of a table are shared, they're only read to build its index
+			size_t const count = items(node);
+			size_t const rows = node.type == TABLE ? this->rows(node) : 0;
+			uint32_t const first = static_cast<uint32_t>(children_.size());
+			children_.resize(children_.size() + count + rows);
+			for (size_t i = 0; i < count; ++i)
+			{
+				uint32_t const copy = copy_node(children_[node.first + i]);
+				children_[first + i] = copy;
+			}
+
+			for (size_t i = 0; i < rows; ++i)
+				children_[first + count + i] = children_[node.first + count + i];
+
+			node.first = first;
+		}
+
+		nodes_.push_back(node);
+		return static_cast<uint32_t>(nodes_.size() - 1);
+	}
+
+	// Returns the position right after the node.  The path is only given to hot nodes.
+	uint32_t place(uint32_t index, uint32_t position, std::string *path)
+	{
+		Node const &node = nodes_[index];
+		placements_[index].position = position;
+
+		uint32_t end = position + node.size;
+		if (node.type == Value::ARRAY)
+		{
+			end = place_array(node.first, node.count, 1, position, path) + static_cast<uint32_t>(index_size(node));
+		}
+		else if (node.type == Value::MAP || node.type == TABLE)
+		{
+			// The columns are placed whole, the rows don't have nodes of their own
+			uint32_t const keys_position = position + NODE_HEADER_SIZE + 8;
+			uint32_t const values_position = place_array(node.first, node.count, 2, keys_position, 0);
+			end = place_array(node.first + 1, node.count, 2, values_position, node.type == TABLE ? 0 : path);
+			end += static_cast<uint32_t>(hash_table_size(node.count) + eytzinger_tree_size(node.count) + index_size(node));
+			placements_[index].keys_size = values_position - keys_position;
+		}
+
+		placements_[index].size = end - position;
+		return end;
+	}
+
+	// The values of a map have a stride of 2, the keys precede them and name them in paths
+	uint32_t place_array(uint32_t first, uint32_t count, uint32_t stride, uint32_t position, std::string *path)
+	{
+		if (packed_type(first, count, stride) != 0)
+			return position + static_cast<uint32_t>(array_size(first, count, stride));
+
+		position += NODE_HEADER_SIZE + 4 + 4 * count;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t const child = children_[first + i * stride];
+			if (!path)
+			{
+				position = place_child(child, position, 0);
+				continue;
+			}
+
+			size_t const length = path->size();
+			if (stride == 2)
+			{
+				uint32_t const key = children_[first + i * stride - 1];
+				if (length > 0)
+					*path += '.';
+				path->append(string_data(key), nodes_[key].count);
+			}
+			else
+			{
+				*path += '[' + std::to_string(i) + ']';
+			}
+
+			if (hot_.count(*path) > 0)
+				position = place_child(child, position, path);
+			else
+				deferred_.push_back(child);
+
+			path->resize(length);
+		}
+
+		return position;
+	}
+
+	uint32_t place_child(uint32_t child, uint32_t position, std::string *path)
+	{
+		if (placements_[child].position == INVALID_NODE)
+			return place(child, position, path);
+
+		++statistics_.duplicates;
+		statistics_.saved_bytes += nodes_[child].size;
+		return position;
+	}
+
+	size_t local_size(uint32_t index) const
+	{
+		return placing() ? placements_[index].size : nodes_[index].size;
+	}
+
+	int compare_strings(uint32_t left, uint32_t right) const
+	{
+		Node const &l = nodes_[left];
+		Node const &r = nodes_[right];
+		int const cmp = memcmp(string_data(left), string_data(right), std::min(l.count, r.count));
+		if (cmp != 0)
+			return cmp;
+
+		return l.count < r.count ? -1 : (l.count > r.count ? 1 : 0);
+	}
+
+	//
+	// Writing
+	//
+
+	class BufferSink
+	{
+	public:
+		explicit BufferSink(char *buffer): begin_(buffer), cursor_(buffer)
+		{
+		}
+
+		void write(void const *data, size_t size)
+		{
+			memcpy(cursor_, data, size);
+			cursor_ += size;
+		}
+
+		size_t position() const
+		{
+			return cursor_ - begin_;
+		}
+
+	private:
+		char *const begin_;
+		char *cursor_;
+	};
+
+	class FileSink
+	{
+	public:
+		explicit FileSink(char const *filename): file_(fopen(filename, "wb")), buffer_(1 << 20), used_(0), flushed_(0)
+		{
+			if (!file_)
+				throw std::runtime_error("Cannot open output file");
+		}
+
+		~FileSink()
+		{
+			if (file_)
+				fclose(file_);
+		}
+
+		void write(void const *data, size_t size)
+		{
+			if (used_ + size > buffer_.size())
+			{
+				flush();
+				if (size > buffer_.size())
+				{
+					write_through(data, size);
+					return;
+				}
+			}
+
+			memcpy(&buffer_[used_], data, size);
+			used_ += size;
+		}
+
+		void close()
+		{
+			flush();
+			int const result = fclose(file_);
+			file_ = 0;
+			if (result != 0)
+				throw std::runtime_error("Cannot write output file");
+		}
+
+		size_t position() const
+		{
+			return flushed_ + used_;
+		}
+
+	private:
+		void flush()
+		{
+			write_through(&buffer_[0], used_);
+			used_ = 0;
+		}
+
+		void write_through(void const *data, size_t size)
+		{
+			if (fwrite(data, 1, size, file_) != size)
+				throw std::runtime_error("Cannot write output file");
+
+			flushed_ += size;
+		}
+
+		FILE *file_;
+		std::vector<char> buffer_;
+		size_t used_;
+		size_t flushed_;
+	};
+
+	template <typename Sink> void write(Sink &sink) const
+	{
+		rodb_assert_or_throw(root_ != INVALID_NODE, "Nothing to compile");
+
+		write_u32(sink, Database::Header::SIGNATURE);
+		write_u32(sink, options_.version);
+		write_node(sink, root_);
+
+		for (size_t i = 0; i < deferred_.size(); ++i)
+			write_placed(sink, deferred_[i]);
+
+		statistics_.output_size = size();
+	}
+
+	template <typename Sink> void write_node(Sink &sink, uint32_t index) const
+	{
+		Node const &node = nodes_[index];
+		if (is_inline(node))
+		{
+			write_inline(sink, index);
+			return;
+		}
+
+		switch (node.type)
+		{
+		case Value::BOOL:
+		case Value::INT:
+		case Value::FLOAT:
+		case Value::DELETED:
+			write_header(sink, node.type, node.size);
+			write_u32(sink, node.first);
+			break;
+
+		case Value::STRING:
+			write_header(sink, node.type, node.size);
+			sink.write(string_data(index), node.count);
+			sink.write("", 1);
+			break;
+
+		case Value::ARRAY:
+			write_array(sink, node.first, node.count, 1, local_size(index), position(index), node.index != 0 ? Value::INDEXED : 0);
+			write_index(sink, node);
+			break;
+
+		case Value::MAP:
+		case TABLE:
+			{
+				size_t const keys_size = placing() ? placements_[index].keys_size : array_size(node.first, node.count, 2);
+				size_t const values_size = placing()
+					? placements_[index].size - keys_size - NODE_HEADER_SIZE - 8 - hash_table_size(node.count) - eytzinger_tree_size(node.count) - index_size(node)
+					: array_size(node.first + 1, node.count, 2);
+				uint32_t const keys_position = position(index) + NODE_HEADER_SIZE + 8;
+
+				write_header(sink, node.type, local_size(index));
+				write_u32(sink, node.type == TABLE ? rows(node) : node.count);
+				write_u32(sink, static_cast<uint32_t>(keys_size));
+				write_array(sink, node.first, node.count, 2, keys_size, keys_position);
+				write_array(sink, node.first + 1, node.count, 2, values_size, keys_position + keys_size);
+				write_hash_table(sink, node);
+				write_eytzinger_tree(sink, node);
+				write_index(sink, node);
+				break;
+			}
+		}
+	}
+
+	// Only known when placing, arrays don't need it otherwise
+	uint32_t position(uint32_t index) const
+	{
+		return placing() ? placements_[index].position : 0;
+	}
+
+	// Placed nodes are written only where they were placed, the other references point there
+	template <typename Sink> void write_placed(Sink &sink, uint32_t index) const
+	{
+		if (placements_[index].position == sink.position())
+			write_node(sink, index);
+	}
+
+	// The offsets are relative to the end of the offset table.  Without placing the items simply
+	// follow the table.
+	template <typename Sink> void write_array(Sink &sink, uint32_t first, uint32_t count, uint32_t stride, size_t size, uint32_t position, uint32_t flags = 0) const
+	{
+		if (uint32_t const element_type = packed_type(first, count, stride))
+		{
+			write_packed_array(sink, first, count, stride, size, element_type);
+			return;
+		}
+
+		write_header(sink, Value::ARRAY | flags, size);
+		write_u32(sink, count);
+
+		uint32_t const table_end = position + NODE_HEADER_SIZE + 4 + 4 * count;
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t const child = children_[first + i * stride];
+			if (placing())
+			{
+				write_u32(sink, placements_[child].position - table_end);
+			}
+			else
+			{
+				write_u32(sink, offset);
+				offset += nodes_[child].size;
+			}
+		}
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t const child = children_[first + i * stride];
+			if (placing())
+				write_placed(sink, child);
+			else
+				write_node(sink, child);
+		}
+	}
+
+	template <typename Sink> void write_packed_array(Sink &sink, uint32_t first, uint32_t count, uint32_t stride, size_t size, uint32_t element_type) const
+	{
+		write_header(sink, Value::ARRAY | (element_type << 8), size);
+		write_u32(sink, count);
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t const bits = nodes_[children_[first + i * stride]].first;
+			if (element_type == Value::BOOL)
+			{
+				char const byte = static_cast<char>(bits);
+				sink.write(&byte, 1);
+			}
+			else
+			{
+				write_u32(sink, bits);
+			}
+		}
+	}
+
+	// Open addressing with linear probing, at most half of the slots are used
+	template <typename Sink> void write_hash_table(Sink &sink, Node const &node) const
+	{
+		size_t const size = hash_table_size(node.count);
+		if (size == 0)
+			return;
+
+		uint32_t const slot_count = hash_slot_count(node.count);
+		std::vector<uint32_t> slots(slot_count * 2, 0);
+		for (uint32_t i = 0; i < slot_count; ++i)
+			slots[2 * i + 1] = Value::EMPTY_SLOT;
+
+		for (uint32_t i = 0; i < node.count; ++i)
+		{
+			uint32_t const hash = hash_string(children_[node.first + 2 * i]);
+			uint32_t slot = hash & (slot_count - 1);
+			while (slots[2 * slot + 1] != Value::EMPTY_SLOT)
+				slot = (slot + 1) & (slot_count - 1);
+
+			slots[2 * slot] = hash;
+			slots[2 * slot + 1] = i;
+		}
+
+		write_u32(sink, Value::HASH_SECTION);
+		write_u32(sink, static_cast<uint32_t>(size - 8));
+		write_u32(sink, slot_count);
+		for (size_t i = 0; i < slots.size(); ++i)
+			write_u32(sink, slots[i]);
+	}
+
+	template <typename Sink> void write_eytzinger_tree(Sink &sink, Node const &node) const
+	{
+		size_t const size = eytzinger_tree_size(node.count);
+		if (size == 0)
+			return;
+
+		std::vector<uint32_t> order(node.count);
+		uint32_t sorted_index = 0;
+		eytzinger_order(order, 1, sorted_index);
+
+		write_u32(sink, Value::EYTZINGER_SECTION);
+		write_u32(sink, static_cast<uint32_t>(size - 8));
+		write_u32(sink, node.count);
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			uint64_t const prefix = string_prefix(children_[node.first + 2 * order[i]]);
+			write_u32(sink, static_cast<uint32_t>(prefix));
+			write_u32(sink, static_cast<uint32_t>(prefix >> 32));
+		}
+
+		for (size_t i = 0; i < order.size(); ++i)
+			write_u32(sink, order[i]);
+	}
+
+	// A hash table per field like the one of maps, see Value::index_section
+	template <typename Sink> void write_index(Sink &sink, Node const &node) const
+	{
+		if (node.index == 0)
+			return;
+
+		size_t sections_size = 0;
+		std::vector<uint32_t> entries;
+		for (size_t i = 0; i < indexes_[node.index].size(); ++i)
+		{
+			std::string const &field = indexes_[node.index][i];
+			index_entries(indexed_rows(node), indexed_count(node), field, entries);
+
+			uint32_t const slot_count = hash_slot_count(entries.size() / 2);
+			std::vector<uint32_t> slots(slot_count * 2, 0);
+			for (uint32_t j = 0; j < slot_count; ++j)
+				slots[2 * j + 1] = Value::EMPTY_SLOT;
+
+			for (size_t j = 0; j < entries.size(); j += 2)
+			{
+				uint32_t slot = entries[j] & (slot_count - 1);
+				while (slots[2 * slot + 1] != Value::EMPTY_SLOT)
+					slot = (slot + 1) & (slot_count - 1);
+
+				slots[2 * slot] = entries[j];
+				slots[2 * slot + 1] = entries[j + 1];
+			}
+
+			size_t const size = index_section_size(field, entries.size() / 2);
+			char const padding[4] = {0};
+			write_u32(sink, Value::INDEX_SECTION);
+			write_u32(sink, static_cast<uint32_t>(size - 8));
+			write_u32(sink, static_cast<uint32_t>(field.size()));
+			sink.write(field.data(), field.size());
+			sink.write(padding, (4 - field.size() % 4) % 4);
+			write_u32(sink, slot_count);
+			for (size_t j = 0; j < slots.size(); ++j)
+				write_u32(sink, slots[j]);
+
+			sections_size += size;
+		}
+
+		if (node.type != TABLE)
+			write_u32(sink, static_cast<uint32_t>(sections_size));
+	}
+
+	// Upper case tag in the lowest byte, the value in the other three
+	template <typename Sink> void write_inline(Sink &sink, uint32_t index) const
+	{
+		Node const &node = nodes_[index];
+		uint32_t const tag = node.type & ~static_cast<uint32_t>(Value::LOWER_CASE);
+		switch (node.type)
+		{
+		case Value::BOOL:
+		case Value::INT:
+		case Value::DELETED:
+			write_u32(sink, tag | (node.first << 8));
+			break;
+
+		case Value::FLOAT:
+			write_u32(sink, tag | node.first);
+			break;
+
+		case Value::STRING:
+			{
+				char bytes[INLINE_SIZE] = {static_cast<char>(tag)};
+				memcpy(bytes + 1, string_data(index), node.count);
+				sink.write(bytes, sizeof(bytes));
+				break;
+			}
+		}
+	}
+
+	// The size in the header doesn't include the header itself
+	template <typename Sink> static void write_header(Sink &sink, uint32_t type, size_t size)
+	{
+		write_u32(sink, type);
+		write_u32(sink, static_cast<uint32_t>(size - NODE_HEADER_SIZE));
+	}
+
+	// The format is little endian
+	template <typename Sink> static void write_u32(Sink &sink, uint32_t value)
+	{
+		unsigned char const bytes[] = {
+			static_cast<unsigned char>(value),
+			static_cast<unsigned char>(value >> 8),
+			static_cast<unsigned char>(value >> 16),
+			static_cast<unsigned char>(value >> 24),
+		};
+		sink.write(bytes, sizeof(bytes));
+	}
+
+	Options options_;
+	std::vector<Node> nodes_;
+	std::vector<uint32_t> children_; // Array elements, key/value pairs of maps sorted by key or key/column pairs of tables and the rows
+	std::vector<char> strings_;
+	std::unordered_set<uint32_t, NodeHash, NodeEqual> unique_nodes_;
+	std::vector<std::vector<std::string> > indexes_; // Fields of the indexed arrays, the first one is none
+	std::vector<Placement> placements_;
+	std::vector<uint32_t> deferred_;     // Cold nodes with hot parents, placed after the root
+	std::unordered_set<std::string> hot_;
+	uint32_t placed_size_;
+	uint32_t root_;
+	mutable Statistics statistics_;
+};
+
+}
+
+#endif
@@ -5,21 +5,45 @@
 #error "Please include rodb.h, don't include Database.h directly."
 #endif
 
+#include <atomic>
 #include <fstream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+#ifndef CONFIG_NO_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 namespace rodb
 {
 
+class Compiler;
+
 class Database
 {
 public:
+	enum Mode
+	{
+		READ, // Read the entire file into a heap buffer
+		MAP,  // Map the file read-only, pages are loaded on first access
+	};
+
+	enum Check
+	{
+		CHECK_HEADER, // Only the signature and the version, values check themselves on access
+		CHECK_ALL,    // Verify the whole structure on load, see verify
+	};
+
 	// Doesn't throw, returns NULL on error
-	static Database *load(char const *filename)
+	static Database *load(char const *filename, Mode mode = READ, Check check = CHECK_HEADER)
 	{
 		try
 		{
-			return new Database(filename);
+			return new Database(filename, mode, check);
 		}
 		catch (std::bad_alloc const &)
 		{
@@ -31,22 +55,63 @@ public:
 		}
 	}
 
-	Database(char const *filename)
+	// Doesn't throw, returns NULL on error
+	static Database *map(char const *filename)
 	{
-		std::ifstream in(filename, std::ios::binary);
-		if (in.fail())
-			throw std::runtime_error("Cannot open input file");
+		return load(filename, MAP);
+	}
 
-		// Get file length
-		in.seekg(0, std::ios::end);
-		std::streampos size = in.tellg();
-		in.seekg(0, std::ios::beg);
+	Database(char const *filename, Mode mode = READ, Check check = CHECK_HEADER): data_(0), size_(0), mapped_(false), allocator_(0), verified_(false), instance_(next_instance())
+	{
+		if (mode == MAP)
+			map_file(filename);
+		else
+			read_file(filename, Allocator::heap());
 
-		// Read the entire file into memory
-		data_.resize(size);
-		in.read(&data_[0], size);
-		
-		check_integriry();
+		validate(check);
+	}
+
+	// Reads the file into memory from the allocator
+	Database(char const *filename, Allocator &allocator, Check check = CHECK_HEADER): data_(0), size_(0), mapped_(false), allocator_(0), verified_(false), instance_(next_instance())
+	{
+		read_file(filename, allocator);
+		validate(check);
+	}
+
+	// Borrows the blob without copying, for example one embedded in the executable or read into a
+	// pool by the caller.  The memory has to stay in place while the database is alive.
+	Database(void const *data, size_t size, Check check = CHECK_HEADER): data_(static_cast<char const *>(data)), size_(size), mapped_(false), allocator_(0), verified_(false), instance_(next_instance())
+	{
+		validate(check);
+	}
+
+	// Copies the blob into memory from the allocator
+	Database(void const *data, size_t size, Allocator &allocator, Check check = CHECK_HEADER): data_(0), size_(0), mapped_(false), allocator_(0), verified_(false), instance_(next_instance())
+	{
+		char *copy = static_cast<char *>(allocate(allocator, size));
+		memcpy(copy, data, size);
+		validate(check);
+	}
+
+	~Database()
+	{
+		release();
+	}
+
+	Mode mode() const
+	{
+		return mapped_ ? MAP : READ;
+	}
+
+	// The memory belongs to the caller, see Database(void const *, size_t)
+	bool borrowed() const
+	{
+		return !mapped_ && allocator_ == 0;
+	}
+
+	size_t size() const
+	{
+		return size_;
 	}
 
 	Value operator [](size_t index)
@@ -64,6 +129,11 @@ public:
 		return root()[key];
 	}
 
+	Value operator [](Key const &key)
+	{
+		return root()[key];
+	}
+
 	void dump(std::ostream &stream = std::cout) const
 	{
 		stream << *this;
@@ -71,7 +141,14 @@ public:
 
 	void dump_yaml(std::ostream &stream) const
 	{
-		dump_yaml(stream, root(), 0);
+		Profile::Pause pause;
+		Dumper(stream, Dumper::YAML).dump(root());
+	}
+
+	void dump_json(std::ostream &stream) const
+	{
+		Profile::Pause pause;
+		Dumper(stream, Dumper::JSON).dump(root());
 	}
 
 	Value root() const
@@ -79,13 +156,36 @@ public:
 		return Value(header_ptr() + 1);
 	}
 
+	// Walks the whole database once: every offset and size stays within the blob, the type tags
+	// are known, the strings are terminated, the map keys are sorted and the map sections are
+	// consistent.  Throws when something is off.  Touches every page of a mapped file.
+	void verify()
+	{
+		Profile::Pause pause;
+		Verifier(data_, size_).verify();
+		verified_ = true;
+	}
+
+	bool verified() const
+	{
+		return verified_;
+	}
+
+	// Same as root, but without any checks on access, see TrustedValue
+	TrustedValue trusted_root() const
+	{
+		rodb_assert_or_throw(verified_, "Database is not verified");
+		return TrustedValue(header_ptr() + 1);
+	}
+
 private:
 	struct Header
 	{
 		enum
 		{
 			SIGNATURE = 0x62646f72, // Should read 'rodb' when saved in little endian
-			VERSION = 1,
+			VERSION = 2,
+			OLDEST_VERSION = 1, // Still readable, doesn't have inline scalars
 		};
 		
 		uint32_t signature_;
@@ -99,66 +199,483 @@ private:
 	
 	Header const *header_ptr() const
 	{
-		return reinterpret_cast<Header const *>(&data_[0]);
+		return reinterpret_cast<Header const *>(data_);
 	}
 	
+	// Tells databases apart even when one is created where another one was, never 0
+	static uint64_t next_instance()
+	{
+		static std::atomic<uint64_t> last(0);
+		return ++last;
+	}
+
+	// The destructor is not called when the constructor throws
+	void validate(Check check)
+	{
+		try
+		{
+			check_integriry();
+			if (check == CHECK_ALL)
+				verify();
+		}
+		catch (...)
+		{
+			release();
+			throw;
+		}
+	}
+
 	void check_integriry() const
 	{
-		if (header().signature_ != Header::SIGNATURE || header().version_ != Header::VERSION)
+		check_header(data_, size_);
+	}
+
+	// The data only has to hold the header, PagedDatabase reads just that much of the file
+	static void check_header(void const *data, size_t size)
+	{
+		if (size < sizeof(Header) + sizeof(uint32_t) * 2)
+			throw std::runtime_error("Database integrity check failed");
+
+		Header header;
+		memcpy(&header, data, sizeof(header));
+		if (header.signature_ != Header::SIGNATURE || header.version_ < Header::OLDEST_VERSION || header.version_ > Header::VERSION)
 			throw std::runtime_error("Database integrity check failed");
 	}
-	
-	
-	void dump_yaml(std::ostream &stream, Value const &value, size_t idndet) const
-	{
-		switch (value.type())
-		{
-		case Value::BOOL:
-			stream << ((bool)value ? "true" : "false");
-			break;
-		case Value::INT:
-			stream << (int)value;
-			break;
-		case Value::FLOAT:
-			stream << (float)value;
-			break;
-		case Value::STRING:
-			stream << "\"" << (char const *)value << "\"";
-			break;
-		case Value::ARRAY:
+
+	// Depth first with an explicit stack, the values are not trusted to be nested sanely.  With
+	// deduplication a value may be referenced many times, it's verified once.  A compound that
+	// contains itself is an error.
+	class Verifier
+	{
+	public:
+		Verifier(char const *data, size_t size): data_(data), size_(size)
+		{
+		}
+
+		void verify()
+		{
+			size_t const root = sizeof(Header);
+			check_range(root, NODE_HEADER_SIZE);
+			uint32_t const type = u32(root) & Value::TAG_MASK;
+			if (type != Value::ARRAY && type != Value::MAP)
+				fail("Root object must be either array or map");
+
+			stack_.push_back(Visit(root, false));
+			while (!stack_.empty())
+			{
+				Visit const visit = stack_.back();
+				stack_.pop_back();
+
+				if (visit.exit)
+					done_[visit.position] = true;
+				else
+					verify_value(visit.position);
+			}
+		}
+
+	private:
+		// The rest of the format constants come from Value, the reader this verifies for
+		enum
+		{
+			NODE_HEADER_SIZE = 8,
+		};
+
+		struct Visit
+		{
+			Visit(size_t position, bool exit): position(position), exit(exit)
+			{
+			}
+
+			size_t position;
+			bool exit; // All the children are verified
+		};
+
+		void verify_value(size_t position)
+		{
+			check_range(position, 4);
+			uint32_t const type = u32(position);
+			uint32_t const tag = type & Value::TAG_MASK;
+
+			// Inline scalars
+			if ((tag & Value::LOWER_CASE) == 0)
 			{
-				stream << "\n";
-				std::string padding(idndet, ' ');
-				for (size_t i = 0; i < value.size(); ++i)
+				switch (tag | Value::LOWER_CASE)
 				{
-					stream << padding << "- ";
-					dump_yaml(stream, value[i], idndet + 4);
-					stream << "\n";
+				case Value::BOOL:
+				case Value::INT:
+				case Value::FLOAT:
+				case Value::DELETED:
+					return;
+
+				case Value::STRING:
+					if (memchr(data_ + position + 1, 0, 3) == 0)
+						fail("String is not terminated");
+					return;
 				}
+
+				fail("Unknown type");
+			}
+
+			check_range(position, NODE_HEADER_SIZE);
+			uint32_t const size = u32(position + 4);
+			size_t const payload = position + NODE_HEADER_SIZE;
+			check_range(payload, size);
+
+			switch (tag)
+			{
+			case Value::BOOL:
+			case Value::INT:
+			case Value::FLOAT:
+			case Value::DELETED:
+				if (type != tag || size != 4)
+					fail("Scalar is corrupted");
+				return;
+
+			case Value::STRING:
+				if (type != tag || size == 0 || data_[payload + size - 1] != 0)
+					fail("String is not terminated");
+				return;
+
+			case Value::ARRAY:
+			case Value::MAP:
 				break;
+
+			default:
+				fail("Unknown type");
 			}
-		case Value::MAP:
+
+			std::unordered_map<size_t, bool>::const_iterator const visited = done_.find(position);
+			if (visited != done_.end())
 			{
-				stream << "\n";
-				std::string padding(idndet, ' ');
-				for (size_t i = 0; i < value.size(); ++i)
+				if (!visited->second)
+					fail("Value contains itself");
+				return;
+			}
+
+			done_[position] = false;
+			stack_.push_back(Visit(position, true));
+
+			if (tag == Value::MAP)
+				verify_map(position, payload + size, false);
+			else if (((type >> 8) & Value::TAG_MASK) == Value::MAP)
+				verify_map(position, payload + size, true);
+			else
+				push_elements(position, verify_array(position, payload + size));
+		}
+
+		// Returns the number of elements, 0 for packed arrays.  The elements are not verified.
+		size_t verify_array(size_t position, size_t end)
+		{
+			check_range(position, NODE_HEADER_SIZE + 4);
+			uint32_t const type = u32(position);
+			uint32_t const flags = type & ~static_cast<uint32_t>(0xffff);
+			if ((type & Value::TAG_MASK) != Value::ARRAY || (flags != 0 && (flags != Value::INDEXED || (type >> 8 & Value::TAG_MASK) != 0)))
+				fail("Array is corrupted");
+
+			size_t const payload = position + NODE_HEADER_SIZE;
+			uint64_t const size = u32(position + 4);
+			uint64_t const count = u32(payload);
+			if (payload + size > end)
+				fail("Array is corrupted");
+
+			if (uint32_t const element_type = (type >> 8) & Value::TAG_MASK)
+			{
+				if (element_type != Value::BOOL && element_type != Value::INT && element_type != Value::FLOAT)
+					fail("Unknown type");
+
+				if (size != 4 + count * Value::packed_size(element_type))
+					fail("Packed array is corrupted");
+
+				return 0;
+			}
+
+			if (size < 4 + 4 * count)
+				fail("Array is corrupted");
+
+			// The index sections are at the end, followed by their size
+			if (flags == Value::INDEXED)
+			{
+				if (size < 4 + 4 * count + 4 || u32(payload + size - 4) > size - 4 - 4 * count - 4)
+					fail("Array is corrupted");
+
+				size_t const sections = payload + size - 4;
+				verify_sections(sections - u32(sections), sections, 0, count);
+			}
+
+			return count;
+		}
+
+		void push_elements(size_t position, size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+				stack_.push_back(Visit(element(position, count, i), false));
+		}
+
+		// Tables are laid out the same way, with the number of rows first and a column per key
+		// in place of the values
+		void verify_map(size_t position, size_t end, bool table)
+		{
+			size_t const payload = position + NODE_HEADER_SIZE;
+			uint32_t const type = table ? Value::ARRAY | Value::MAP << 8 : Value::MAP;
+			if (u32(position) != type || end - payload < 8)
+				fail("Map is corrupted");
+
+			size_t const keys = payload + 8;
+			size_t const values = keys + u32(payload + 4);
+			check_range(keys, NODE_HEADER_SIZE + 4);
+			if (keys + NODE_HEADER_SIZE + u32(keys + 4) != values)
+				fail("Map is corrupted");
+
+			uint32_t const count = table ? u32(keys + NODE_HEADER_SIZE) : u32(payload);
+
+			// The keys are strings, verify them right away
+			if (verify_array(keys, values) != count || u32(keys + NODE_HEADER_SIZE) != count)
+				fail("Map is corrupted");
+
+			char const *previous = 0;
+			size_t previous_length = 0;
+			keys_.clear();
+			for (size_t i = 0; i < count; ++i)
+			{
+				size_t const key = element(keys, count, i);
+				verify_value(key);
+				if (((u32(key) & Value::TAG_MASK) | Value::LOWER_CASE) != Value::STRING)
+					fail("Map key is not a string");
+
+				bool const is_inline = (u32(key) & Value::LOWER_CASE) == 0;
+				char const *data = data_ + key + (is_inline ? 1 : NODE_HEADER_SIZE);
+				size_t const length = is_inline ? strlen(data) : u32(key + 4) - 1;
+				if (previous != 0 && compare(previous, previous_length, data, length) >= 0)
+					fail("Map keys are not sorted");
+
+				previous = data;
+				previous_length = length;
+				keys_.push_back(Key(data, length));
+			}
+
+			check_range(values, NODE_HEADER_SIZE + 4);
+			size_t const sections = values + NODE_HEADER_SIZE + u32(values + 4);
+			size_t const value_count = verify_array(values, end);
+			if (u32(values + NODE_HEADER_SIZE) != count)
+				fail("Map is corrupted");
+
+			push_elements(values, value_count);
+			if (table)
+			{
+				uint32_t const rows = u32(payload);
+				for (size_t i = 0; i < count; ++i)
 				{
-					stream << padding;
-					dump_yaml(stream, value.keys()[i], idndet);
-					stream << ": ";
-					dump_yaml(stream, value.values()[i], idndet + 4);
-					stream << "\n";
+					size_t const column = element(values, count, i);
+					check_range(column, NODE_HEADER_SIZE + 4);
+					if ((u32(column) & Value::TAG_MASK) != Value::ARRAY || u32(column + NODE_HEADER_SIZE) != rows)
+						fail("Table column is corrupted");
 				}
-				break;
 			}
+
+			if (sections == end)
+				return;
+
+			// Every key has to be found through whatever the map has for lookups
+			verify_sections(sections, end, count, table ? u32(payload) : 0);
+			Value const map(data_ + position, table ? Value::ROW_VIEW : 0);
+			for (size_t i = 0; i < count; ++i)
+				if (map.key_index(keys_[i]) != i)
+					fail("Map lookup is inconsistent");
+		}
+
+		// Tag, size of the data, data.  The count is the number of keys, the rows are the number of
+		// elements an index may refer to.
+		void verify_sections(size_t position, size_t end, uint32_t count, uint32_t rows)
+		{
+			while (position < end)
+			{
+				if (end - position < 8 || end - position - 8 < u32(position + 4))
+					fail("Map section is corrupted");
+
+				uint32_t const tag = u32(position);
+				uint64_t const size = u32(position + 4);
+				size_t const data = position + 8;
+
+				if (tag == Value::HASH_SECTION)
+				{
+					uint64_t const slot_count = size < 4 ? 0 : u32(data);
+					if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0 || size != 4 + 8 * slot_count)
+						fail("Map hash table is corrupted");
+
+					for (size_t i = 0; i < slot_count; ++i)
+					{
+						uint32_t const index = u32(data + 4 + 8 * i + 4);
+						if (index != Value::EMPTY_SLOT && index >= count)
+							fail("Map hash table is corrupted");
+					}
+				}
+				else if (tag == Value::EYTZINGER_SECTION)
+				{
+					if (size < 4 || u32(data) != count || size != 4 + 12 * static_cast<uint64_t>(count))
+						fail("Map key tree is corrupted");
+
+					for (size_t i = 0; i < count; ++i)
+						if (u32(data + 4 + 8 * count + 4 * i) >= count)
+							fail("Map key tree is corrupted");
+				}
+				else if (tag == Value::INDEX_SECTION)
+				{
+					uint64_t const name_size = size < 4 ? size : (u32(data) + 3ull) / 4 * 4;
+					uint64_t const table = 4 + name_size;
+					uint64_t const slot_count = size < table + 4 ? 0 : u32(data + table);
+					if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0 || size != table + 4 + 8 * slot_count)
+						fail("Array index is corrupted");
+
+					for (size_t i = 0; i < slot_count; ++i)
+					{
+						uint32_t const index = u32(data + table + 4 + 8 * i + 4);
+						if (index != Value::EMPTY_SLOT && index >= rows)
+							fail("Array index is corrupted");
+					}
+				}
+
+				position = data + size;
+			}
+		}
+
+		// The offsets are relative to the end of the offset table, anything outside of the blob
+		// wraps around and fails the range check later
+		size_t element(size_t array, size_t count, size_t i) const
+		{
+			size_t const table = array + NODE_HEADER_SIZE + 4;
+			int32_t const offset = static_cast<int32_t>(u32(table + 4 * i));
+			return table + 4 * count + offset;
+		}
+
+		static int compare(char const *left, size_t left_length, char const *right, size_t right_length)
+		{
+			int const cmp = memcmp(left, right, left_length < right_length ? left_length : right_length);
+			if (cmp != 0)
+				return cmp;
+
+			return left_length < right_length ? -1 : (left_length > right_length ? 1 : 0);
+		}
+
+		void check_range(size_t position, uint64_t size) const
+		{
+			if (position < sizeof(Header) || position > size_ || size > size_ - position)
+				fail("Value is out of bounds");
+		}
+
+		uint32_t u32(size_t position) const
+		{
+			uint32_t value;
+			memcpy(&value, data_ + position, sizeof(value));
+			return value;
+		}
+
+		static void fail(char const *reason)
+		{
+			throw std::runtime_error(std::string("Database verification failed: ") + reason);
+		}
+
+		char const *data_;
+		size_t size_;
+		std::vector<Visit> stack_;
+		std::vector<Key> keys_; // Of the current map
+		std::unordered_map<size_t, bool> done_; // Compounds, false while the children are verified
+	};
+
+	void read_file(char const *filename, Allocator &allocator)
+	{
+		std::ifstream in(filename, std::ios::binary);
+		if (in.fail())
+			throw std::runtime_error("Cannot open input file");
+
+		// Get file length
+		in.seekg(0, std::ios::end);
+		std::streampos size = in.tellg();
+		in.seekg(0, std::ios::beg);
+
+		// Read the entire file into memory
+		char *buffer = static_cast<char *>(allocate(allocator, size));
+		in.read(buffer, size);
+	}
+
+	// The memory is owned from here on
+	void *allocate(Allocator &allocator, size_t size)
+	{
+		if (size == 0)
+			return 0;
+
+		void *memory = allocator.allocate(size);
+		data_ = static_cast<char const *>(memory);
+		size_ = size;
+		allocator_ = &allocator;
+		return memory;
+	}
+
+	void release()
+	{
+		if (mapped_)
+			unmap_file();
+		else if (allocator_ != 0)
+			allocator_->deallocate(const_cast<char *>(data_), size_);
+
+		data_ = 0;
+		size_ = 0;
+		mapped_ = false;
+		allocator_ = 0;
+	}
+
+#ifdef CONFIG_NO_MMAP
+	void map_file(char const *)
+	{
+		throw std::runtime_error("Memory mapping is disabled");
+	}
+
+	void unmap_file()
+	{
+	}
+#else
+	void map_file(char const *filename)
+	{
+		int fd = open(filename, O_RDONLY);
+		if (fd == -1)
+			throw std::runtime_error("Cannot open input file");
+
+		struct stat st;
+		if (fstat(fd, &st) == -1 || st.st_size == 0)
+		{
+			close(fd);
+			throw std::runtime_error("Database integrity check failed");
 		}
+
+		// Shared read-only mapping: the pages come straight from the page cache and are only
+		// faulted in when a Value touches them.  The descriptor is not needed once mapped.
+		void *p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (p == MAP_FAILED)
+			throw std::runtime_error("Cannot map input file");
+
+		data_ = static_cast<char const *>(p);
+		size_ = st.st_size;
+		mapped_ = true;
 	}
 
-	std::vector<char> data_;
+	void unmap_file()
+	{
+		munmap(const_cast<char *>(data_), size_);
+	}
+#endif
+	
+	
+	char const *data_;
+	size_t size_;
+	bool mapped_;
+	Allocator *allocator_; // Owns the memory unless mapped or borrowed
+	bool verified_;
+	uint64_t const instance_;
 
 	// Beyond private ;)
 private: 
-	Database(Database const &)
+	Database(Database const &): instance_(0)
 	{
 		throw std::logic_error("Cannot copy construct Database");
 	}
@@ -169,15 +686,20 @@ private:
 	}
 
 	// BFF
+	friend class Compiler;
+	friend class Delta;
+	friend class PagedDatabase;
+	friend class Path;
 	friend std::ostream &operator <<(std::ostream &stream, Database const&db);
 };
 
 inline std::ostream &operator <<(std::ostream &stream, Database const&db)
 {
 	return stream
-		<< " Total size: " << db.data_.size() << "\n"
+		<< "    Storage: " << (db.mode() == Database::MAP ? "mapped" : (db.borrowed() ? "borrowed" : "allocated")) << "\n"
+		<< " Total size: " << db.size() << "\n"
 		<< "Header size: " << sizeof(db.header()) << "\n"
-		<< "  Data size: " << db.data_.size() - sizeof(db.header()) << "\n"
+		<< "  Data size: " << db.size() - sizeof(db.header()) << "\n"
 		<< "  Signature: " << "0x" << std::hex << db.header().signature_ << std::dec << "\n"
 		<< "    Version: " << db.header().version_ << "\n";
 }
@@ -0,0 +1,280 @@
+#ifndef database_handle_h_included
+#define database_handle_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include DatabaseHandle.h directly."
+#endif
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rodb
+{
+
+// A database that can be reloaded while other threads read it.  Readers don't take any locks:
+// a reader thread registers once and then pins the current database with a Snapshot for as long
+// as it uses values from it.  A reload loads the new file on the side, publishes it with an
+// atomic pointer swap and frees the old database once no snapshot taken before the swap is left.
+//
+//     DatabaseHandle handle("config.rodb");
+//
+//     // In each reader thread
+//     DatabaseHandle::Reader reader(handle);
+//     while (running)
+//     {
+//         DatabaseHandle::Snapshot snapshot(reader);
+//         float speed = snapshot.root()["player"]["speed"];
+//     }
+//
+//     // In the editor thread
+//     handle.reload_async();
+//
+// With Database::MAP the file has to be replaced by renaming a new one over it.  Writing into the
+// mapped file changes or truncates the pages under the readers.
+//
+// Reclamation is epoch based.  Every reload bumps the epoch, an active reader slot holds the
+// epoch it entered in and a retired database is freed once every active slot is newer than it.
+class DatabaseHandle
+{
+	struct Slot;
+
+public:
+	class Reader;
+	class Snapshot;
+
+	// Throws like Database does when the initial load fails
+	DatabaseHandle(char const *filename, Database::Mode mode = Database::READ, Database::Check check = Database::CHECK_HEADER):
+		filename_(filename),
+		mode_(mode),
+		check_(check),
+		current_(new Database(filename, mode, check)),
+		epoch_(1),
+		generation_(1)
+	{
+	}
+
+	// All readers must be gone by now
+	~DatabaseHandle()
+	{
+		if (loader_.joinable())
+			loader_.join();
+
+		delete current_.load();
+		for (size_t i = 0; i < retired_.size(); ++i)
+			delete retired_[i].database;
+
+		for (size_t i = 0; i < slots_.size(); ++i)
+			delete slots_[i];
+	}
+
+	// Loads the file again and publishes it.  On failure the current database stays and false
+	// is returned.  Safe to call from any thread, reloads are serialized.
+	bool reload()
+	{
+		Database *database = Database::load(filename_.c_str(), mode_, check_);
+
+		std::lock_guard<std::mutex> lock(writer_mutex_);
+		if (database == 0)
+			return false;
+
+		Database *old = current_.exchange(database);
+		Retired const retired = {old, epoch_.fetch_add(1)};
+		retired_.push_back(retired);
+		++generation_;
+
+		collect_locked();
+		return true;
+	}
+
+	// Same as reload, on a background thread.  Waits for the previous background reload first.
+	void reload_async()
+	{
+		std::lock_guard<std::mutex> lock(loader_mutex_);
+		if (loader_.joinable())
+			loader_.join();
+
+		loader_ = std::thread(&DatabaseHandle::reload, this);
+	}
+
+	// Frees retired databases nobody can be reading anymore.  Reloads do it as well.
+	void collect()
+	{
+		std::lock_guard<std::mutex> lock(writer_mutex_);
+		collect_locked();
+	}
+
+	// Number of databases published so far, the initial one included
+	size_t generation() const
+	{
+		return generation_.load();
+	}
+
+	// Number of replaced databases still waiting for readers to let go
+	size_t retired() const
+	{
+		std::lock_guard<std::mutex> lock(writer_mutex_);
+		return retired_.size();
+	}
+
+	// Reader registration, one per thread.  Holds a slot in the handle for its lifetime, only
+	// the registration itself takes a lock.
+	class Reader
+	{
+	public:
+		explicit Reader(DatabaseHandle &handle): handle_(handle), slot_(handle.acquire_slot())
+		{
+		}
+
+		~Reader()
+		{
+			handle_.release_slot(slot_);
+		}
+
+	private:
+		DatabaseHandle &handle_;
+		Slot *const slot_;
+
+		Reader(Reader const &);
+		Reader &operator =(Reader const &);
+
+		// BFF
+		friend class Snapshot;
+	};
+
+	// Pins the database that is current at construction.  Values taken from it stay valid until
+	// the snapshot is destroyed.  One snapshot per reader at a time.
+	class Snapshot
+	{
+	public:
+		explicit Snapshot(Reader &reader): slot_(*reader.slot_)
+		{
+			rodb_assert_or_throw(slot_.epoch.load() == IDLE, "Reader already has a snapshot");
+
+			// The epoch goes in first, so a swap after this point can't free what's loaded next
+			slot_.epoch.store(reader.handle_.epoch_.load());
+			database_ = reader.handle_.current_.load();
+		}
+
+		~Snapshot()
+		{
+			slot_.epoch.store(IDLE);
+		}
+
+		Database const &database() const
+		{
+			return *database_;
+		}
+
+		Value root() const
+		{
+			return database_->root();
+		}
+
+	private:
+		Slot &slot_;
+		Database const *database_;
+
+		Snapshot(Snapshot const &);
+		Snapshot &operator =(Snapshot const &);
+	};
+
+private:
+	enum
+	{
+		IDLE = 0,
+	};
+
+	// A cache line of its own, readers write to it all the time.  Aligned new (C++17) keeps the
+	// separately allocated slots on their own lines.
+	struct alignas(64) Slot
+	{
+		Slot(): epoch(IDLE), used(false)
+		{
+		}
+
+		std::atomic<uint64_t> epoch; // IDLE or the epoch the snapshot was taken in
+		bool used;                   // Guarded by the slot mutex
+	};
+
+	struct Retired
+	{
+		Database *database;
+		uint64_t epoch; // The last epoch it was current in
+	};
+
+	Slot *acquire_slot()
+	{
+		std::lock_guard<std::mutex> lock(slot_mutex_);
+		for (size_t i = 0; i < slots_.size(); ++i)
+		{
+			if (!slots_[i]->used)
+			{
+				slots_[i]->used = true;
+				return slots_[i];
+			}
+		}
+
+		slots_.push_back(new Slot);
+		slots_.back()->used = true;
+		return slots_.back();
+	}
+
+	void release_slot(Slot *slot)
+	{
+		std::lock_guard<std::mutex> lock(slot_mutex_);
+		slot->used = false;
+	}
+
+	// A database retired in epoch e may still be read by snapshots entered in e or earlier
+	void collect_locked()
+	{
+		uint64_t oldest = epoch_.load();
+		{
+			std::lock_guard<std::mutex> lock(slot_mutex_);
+			for (size_t i = 0; i < slots_.size(); ++i)
+			{
+				uint64_t const epoch = slots_[i]->epoch.load();
+				if (epoch != IDLE && epoch < oldest)
+					oldest = epoch;
+			}
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < retired_.size(); ++i)
+		{
+			if (retired_[i].epoch < oldest)
+				delete retired_[i].database;
+			else
+				retired_[kept++] = retired_[i];
+		}
+
+		retired_.resize(kept);
+	}
+
+	std::string const filename_;
+	Database::Mode const mode_;
+	Database::Check const check_;
+
+	std::atomic<Database *> current_;
+	std::atomic<uint64_t> epoch_;
+	std::atomic<size_t> generation_;
+
+	mutable std::mutex writer_mutex_; // Reloads and the retired list
+	std::vector<Retired> retired_;
+
+	std::mutex slot_mutex_; // Reader registration and the slot list
+	std::vector<Slot *> slots_;
+
+	std::mutex loader_mutex_;
+	std::thread loader_;
+
+	DatabaseHandle(DatabaseHandle const &);
+	DatabaseHandle &operator =(DatabaseHandle const &);
+};
+
+}
+
+#endif
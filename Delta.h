@@ -0,0 +1,365 @@
+#ifndef delta_h_included
+#define delta_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Delta.h directly."
+#endif
+
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace rodb
+{
+
+// Binary deltas between two blobs.  All the offsets in a blob are relative, so a subtree that
+// didn't change compiles to the same bytes wherever it ends up.  A delta copies those over from
+// the old blob and carries only the bytes that are new: the changed values and the offsets and
+// sizes around them.
+//
+//     std::vector<char> delta;
+//     Delta::make(old_db, new_db, delta);
+//
+//     // On the other end
+//     std::vector<char> blob;
+//     Delta::apply(old_db, &delta[0], delta.size(), blob);
+//     Database new_db(&blob[0], blob.size(), Database::CHECK_ALL);
+//
+// A delta has to be applied to the blob it was made from, only the size is checked.  Verify the
+// result when that's not certain.
+class Delta
+{
+public:
+	static void make(Database const &from, Database const &to, std::vector<char> &delta)
+	{
+		make(from.data_, from.size_, to.data_, to.size_, delta);
+	}
+
+	// The blobs don't have to be valid databases
+	static void make(void const *from, size_t from_size, void const *to, size_t to_size, std::vector<char> &delta)
+	{
+		rodb_assert_or_throw(from_size <= 0xffffffffu && to_size <= 0xffffffffu, "Blob is too large");
+
+		Maker maker(static_cast<char const *>(from), from_size, static_cast<char const *>(to), to_size, delta);
+		maker.make();
+	}
+
+	// The size of the blob the delta makes
+	static size_t target_size(void const *delta, size_t size)
+	{
+		return read_header(delta, size).to_size;
+	}
+
+	static void apply(Database const &from, void const *delta, size_t size, std::vector<char> &blob)
+	{
+		blob.resize(target_size(delta, size));
+		apply(from.data_, from.size_, delta, size, blob.empty() ? 0 : &blob[0]);
+	}
+
+	// Writes target_size bytes to out, which must not overlap from
+	static void apply(void const *from, size_t from_size, void const *delta, size_t size, void *out)
+	{
+		Header const header = read_header(delta, size);
+		rodb_assert_or_throw(header.from_size == from_size, "Delta is made for a different blob");
+
+		char const *source = static_cast<char const *>(from);
+		char *target = static_cast<char *>(out);
+		char const *op = static_cast<char const *>(delta) + sizeof(Header);
+		char const *end = static_cast<char const *>(delta) + size;
+		uint32_t position = 0;
+		for (uint32_t i = 0; i < header.op_count; ++i)
+		{
+			Op const o = read_op(op, end, header, position);
+			memcpy(target + position, o.kind == COPY ? source + o.source : o.data, o.length);
+			position += o.length;
+		}
+
+		rodb_assert_or_throw(position == header.to_size, "Delta is corrupted");
+	}
+
+	// Turns the blob into the new one right where it is.  The bytes copied to where they already
+	// are aren't touched, so when the changed values keep their sizes only the changes are written.
+	// The buffer must have room for the larger of the two blobs.  Returns false without changing
+	// anything when the delta moves the data around in a way that can't be done in place, apply
+	// into a new buffer then.
+	static bool apply_in_place(void *blob, size_t size, size_t capacity, void const *delta, size_t delta_size)
+	{
+		Header const header = read_header(delta, delta_size);
+		rodb_assert_or_throw(header.from_size == size, "Delta is made for a different blob");
+		rodb_assert_or_throw(header.to_size <= capacity, "Buffer is too small for the delta");
+
+		char const *op = static_cast<char const *>(delta) + sizeof(Header);
+		char const *const end = static_cast<char const *>(delta) + delta_size;
+
+		// The copies that move data must not read anything that's been written already, going
+		// front to back when the data moves down and back to front when it moves up
+		std::vector<Op> moves;
+		bool forward = true;
+		bool backward = true;
+		uint32_t position = 0;
+		for (uint32_t i = 0; i < header.op_count; ++i)
+		{
+			Op const o = read_op(op, end, header, position);
+			if (o.kind != COPY || o.source != position)
+				moves.push_back(o);
+
+			position += o.length;
+		}
+
+		rodb_assert_or_throw(position == header.to_size, "Delta is corrupted");
+
+		size_t written = 0;
+		for (size_t i = 0; i < moves.size() && forward; ++i)
+		{
+			forward = moves[i].kind == ADD || moves[i].source >= written;
+			written = moves[i].target + moves[i].length;
+		}
+
+		written = capacity;
+		for (size_t i = moves.size(); i > 0 && backward && !forward; --i)
+		{
+			Op const &o = moves[i - 1];
+			backward = o.kind == ADD || o.source + o.length <= written;
+			written = o.target;
+		}
+
+		if (!forward && !backward)
+			return false;
+
+		// The added bytes go last, they might overwrite the sources of copies on either side
+		char *target = static_cast<char *>(blob);
+		for (size_t i = 0; i < moves.size(); ++i)
+		{
+			Op const &o = moves[forward ? i : moves.size() - 1 - i];
+			if (o.kind == COPY)
+				memmove(target + o.target, target + o.source, o.length);
+		}
+
+		for (size_t i = 0; i < moves.size(); ++i)
+		{
+			if (moves[i].kind == ADD)
+				memcpy(target + moves[i].target, moves[i].data, moves[i].length);
+		}
+
+		return true;
+	}
+
+private:
+	enum
+	{
+		SIGNATURE = 0x746c6472, // 'rdlt'
+		VERSION = 1,
+		COPY = 'c',             // Bytes from the old blob: kind, length, source offset
+		ADD = 'a',              // New bytes: kind, length, the bytes
+		BLOCK_SIZE = 32,        // The shortest copy the maker looks for
+	};
+
+	struct Header
+	{
+		uint32_t signature;
+		uint32_t version;
+		uint32_t from_size;
+		uint32_t to_size;
+		uint32_t op_count;
+	};
+
+	struct Op
+	{
+		uint32_t kind;
+		uint32_t length;
+		uint32_t source; // COPY
+		uint32_t target;
+		char const *data; // ADD
+	};
+
+	static Header read_header(void const *delta, size_t size)
+	{
+		Header header;
+		rodb_assert_or_throw(size >= sizeof(header), "Delta is corrupted");
+
+		memcpy(&header, delta, sizeof(header));
+		rodb_assert_or_throw(header.signature == SIGNATURE && header.version == VERSION, "Delta is corrupted");
+
+		return header;
+	}
+
+	// Advances op past the one it reads, the ops write the target front to back
+	static Op read_op(char const *&op, char const *end, Header const &header, uint32_t position)
+	{
+		Op o;
+		rodb_assert_or_throw(end - op >= 8, "Delta is corrupted");
+		memcpy(&o.kind, op, 4);
+		memcpy(&o.length, op + 4, 4);
+		op += 8;
+
+		o.target = position;
+		rodb_assert_or_throw(o.length <= header.to_size - position, "Delta is corrupted");
+		if (o.kind == COPY)
+		{
+			rodb_assert_or_throw(end - op >= 4, "Delta is corrupted");
+			memcpy(&o.source, op, 4);
+			op += 4;
+
+			rodb_assert_or_throw(o.source <= header.from_size && o.length <= header.from_size - o.source, "Delta is corrupted");
+			o.data = 0;
+		}
+		else
+		{
+			rodb_assert_or_throw(o.kind == ADD && static_cast<size_t>(end - op) >= o.length, "Delta is corrupted");
+			o.source = 0;
+			o.data = op;
+			op += o.length;
+		}
+
+		return o;
+	}
+
+	// rsync style: the old blob is hashed in blocks, the new one is scanned with a rolling hash of
+	// the same size and every block found in the old one is grown into the longest copy around it.
+	// Unchanged data usually continues at the same distance from the last copy, so that's tried
+	// before the hash table.
+	class Maker
+	{
+	public:
+		Maker(char const *from, size_t from_size, char const *to, size_t to_size, std::vector<char> &delta):
+			from_(from),
+			from_size_(from_size),
+			to_(to),
+			to_size_(to_size),
+			delta_(delta),
+			op_count_(0)
+		{
+		}
+
+		void make()
+		{
+			delta_.assign(sizeof(Header), 0);
+
+			for (size_t i = 0; i + BLOCK_SIZE <= from_size_; i += BLOCK_SIZE)
+				blocks_.insert(std::make_pair(block_hash(from_ + i), static_cast<uint32_t>(i)));
+
+			uint32_t power = 1;
+			for (size_t i = 1; i < BLOCK_SIZE; ++i)
+				power *= MULTIPLIER;
+
+			size_t added = 0;     // Start of the bytes not written to the delta yet
+			ptrdiff_t shift = 0;  // Source minus target of the last copy
+			size_t position = 0;
+			uint32_t hash = 0;
+			bool hashed = false;
+			while (position + BLOCK_SIZE <= to_size_)
+			{
+				size_t source;
+				if (!find(position, shift, hashed ? hash : (hash = block_hash(to_ + position)), source))
+				{
+					// Roll the hash one byte on
+					if (position + BLOCK_SIZE < to_size_)
+						hash = (hash - power * static_cast<unsigned char>(to_[position])) * MULTIPLIER + static_cast<unsigned char>(to_[position + BLOCK_SIZE]);
+
+					hashed = true;
+					++position;
+					continue;
+				}
+
+				// Grow the copy both ways, back over the bytes that would be added otherwise
+				size_t begin = position;
+				while (begin > added && source > 0 && from_[source - 1] == to_[begin - 1])
+				{
+					--begin;
+					--source;
+				}
+
+				size_t length = position - begin + BLOCK_SIZE;
+				while (begin + length < to_size_ && source + length < from_size_ && from_[source + length] == to_[begin + length])
+					++length;
+
+				add(added, begin);
+				copy(source, length);
+
+				shift = static_cast<ptrdiff_t>(source) - static_cast<ptrdiff_t>(begin);
+				position = added = begin + length;
+				hashed = false;
+			}
+
+			add(added, to_size_);
+
+			Header const header = {SIGNATURE, VERSION, static_cast<uint32_t>(from_size_), static_cast<uint32_t>(to_size_), op_count_};
+			memcpy(&delta_[0], &header, sizeof(header));
+		}
+
+	private:
+		enum
+		{
+			MULTIPLIER = 16777619,
+		};
+
+		static uint32_t block_hash(char const *data)
+		{
+			uint32_t hash = 0;
+			for (size_t i = 0; i < BLOCK_SIZE; ++i)
+				hash = hash * MULTIPLIER + static_cast<unsigned char>(data[i]);
+
+			return hash;
+		}
+
+		bool find(size_t position, ptrdiff_t shift, uint32_t hash, size_t &source) const
+		{
+			ptrdiff_t const shifted = static_cast<ptrdiff_t>(position) + shift;
+			if (shifted >= 0 && static_cast<size_t>(shifted) + BLOCK_SIZE <= from_size_ && memcmp(from_ + shifted, to_ + position, BLOCK_SIZE) == 0)
+			{
+				source = shifted;
+				return true;
+			}
+
+			std::unordered_map<uint32_t, uint32_t>::const_iterator const block = blocks_.find(hash);
+			if (block != blocks_.end() && memcmp(from_ + block->second, to_ + position, BLOCK_SIZE) == 0)
+			{
+				source = block->second;
+				return true;
+			}
+
+			return false;
+		}
+
+		void add(size_t begin, size_t end)
+		{
+			if (begin == end)
+				return;
+
+			write(ADD);
+			write(static_cast<uint32_t>(end - begin));
+			delta_.insert(delta_.end(), to_ + begin, to_ + end);
+			++op_count_;
+		}
+
+		void copy(size_t source, size_t length)
+		{
+			write(COPY);
+			write(static_cast<uint32_t>(length));
+			write(static_cast<uint32_t>(source));
+			++op_count_;
+		}
+
+		void write(uint32_t value)
+		{
+			char bytes[4];
+			memcpy(bytes, &value, sizeof(bytes));
+			delta_.insert(delta_.end(), bytes, bytes + sizeof(bytes));
+		}
+
+		char const *const from_;
+		size_t const from_size_;
+		char const *const to_;
+		size_t const to_size_;
+		std::vector<char> &delta_;
+		uint32_t op_count_;
+		std::unordered_map<uint32_t, uint32_t> blocks_; // Hash to the first block with it
+
+		Maker(Maker const &);
+		Maker &operator =(Maker const &);
+	};
+};
+
+}
+
+#endif
@@ -0,0 +1,349 @@
+#ifndef dumper_h_included
+#define dumper_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Dumper.h directly."
+#endif
+
+#include <cstdio>
+#include <ostream>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+namespace rodb
+{
+
+// Writes values out as YAML or JSON.  The text goes into a buffer that's handed to the stream
+// whenever it fills up, so the stream sees a few big writes.  The buffer is kept between dumps,
+// one dumper can write any number of databases.  Both compilers read the YAML back into the same
+// values, floats included.
+//
+//     rodb::Dumper dumper(std::cout, rodb::Dumper::JSON);
+//     dumper.dump(db.root());
+class Dumper
+{
+public:
+	enum Format
+	{
+		YAML,
+		JSON,
+	};
+
+	Dumper(std::ostream &stream, Format format = YAML, size_t buffer_size = 64 * 1024):
+		stream_(stream),
+		format_(format),
+		buffer_(buffer_size > 0 ? buffer_size : 1),
+		used_(0)
+	{
+	}
+
+	~Dumper()
+	{
+		flush();
+	}
+
+	// A document ending with a new line
+	template <typename Checks> void dump(BasicValue<Checks> const &value)
+	{
+		if (format_ == JSON)
+			json_value(value, 0);
+		else if (is_block(value))
+			yaml_block(value, 0);
+		else
+			scalar(value);
+
+		if (format_ == JSON || !is_block(value))
+			put('\n');
+	}
+
+	void flush()
+	{
+		stream_.write(&buffer_[0], used_);
+		used_ = 0;
+	}
+
+private:
+	enum
+	{
+		INDENT = 4,
+	};
+
+	// Non-empty arrays and maps, the rest fit on one line
+	template <typename Checks> static bool is_block(BasicValue<Checks> const &value)
+	{
+		return value.is_compound() && value.size() > 0;
+	}
+
+	template <typename Checks> void yaml_block(BasicValue<Checks> const &value, size_t indent)
+	{
+		if (value.is_map())
+		{
+			BasicValue<Checks> const keys = value.keys();
+			BasicValue<Checks> const values = value.values();
+			for (size_t i = 0; i < keys.size(); ++i)
+			{
+				pad(indent);
+				scalar(keys[i]);
+				put(':');
+				yaml_item(values[i], indent);
+			}
+		}
+		else
+		{
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				pad(indent);
+				put('-');
+				yaml_item(value[i], indent);
+			}
+		}
+	}
+
+	template <typename Checks> void yaml_item(BasicValue<Checks> const &value, size_t indent)
+	{
+		if (is_block(value))
+		{
+			put('\n');
+			yaml_block(value, indent + INDENT);
+		}
+		else
+		{
+			put(' ');
+			scalar(value);
+			put('\n');
+		}
+	}
+
+	template <typename Checks> void json_value(BasicValue<Checks> const &value, size_t indent)
+	{
+		if (!is_block(value))
+		{
+			scalar(value);
+			return;
+		}
+
+		bool const map = value.is_map();
+		put(map ? '{' : '[');
+		put('\n');
+
+		BasicValue<Checks> const keys = map ? value.keys() : value;
+		BasicValue<Checks> const values = map ? value.values() : value;
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			pad(indent + INDENT);
+			if (map)
+			{
+				scalar(keys[i]);
+				write(": ", 2);
+			}
+
+			json_value(values[i], indent + INDENT);
+			if (i + 1 < values.size())
+				put(',');
+
+			put('\n');
+		}
+
+		pad(indent);
+		put(map ? '}' : ']');
+	}
+
+	template <typename Checks> void scalar(BasicValue<Checks> const &value)
+	{
+		switch (value.type())
+		{
+		case Value::BOOL:
+			if ((bool)value)
+				write("true", 4);
+			else
+				write("false", 5);
+			break;
+		case Value::INT:
+			integer((int)value);
+			break;
+		case Value::FLOAT:
+			real((float)value);
+			break;
+		case Value::STRING:
+			string(value.string_data(), value.string_length());
+			break;
+		case Value::DELETED:
+			if (format_ == JSON)
+				write("null", 4);
+			else
+				put('~');
+			break;
+		case Value::ARRAY:
+			write("[]", 2);
+			break;
+		case Value::MAP:
+			write("{}", 2);
+			break;
+		}
+	}
+
+	void integer(int value)
+	{
+		char text[16];
+		char *const end = text + sizeof(text);
+		char *p = end;
+
+		uint32_t left = value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+		do
+		{
+			*--p = static_cast<char>('0' + left % 10);
+			left /= 10;
+		}
+		while (left != 0);
+
+		if (value < 0)
+			*--p = '-';
+
+		write(p, end - p);
+	}
+
+	// Text that reads back as the same float, always with a dot so it doesn't turn into an int.
+	// to_chars gives the shortest such text, the %.9g fallback is longer (0.1f is 0.100000001).
+	void real(float value)
+	{
+		// NaN and the infinities, JSON doesn't have them
+		if (value - value != 0)
+		{
+			if (format_ == JSON)
+				write("null", 4);
+			else if (value != value)
+				write(".nan", 4);
+			else if (value > 0)
+				write(".inf", 4);
+			else
+				write("-.inf", 5);
+			return;
+		}
+
+		char text[32];
+#ifdef __cpp_lib_to_chars
+		size_t length = std::to_chars(text, text + sizeof(text), value).ptr - text;
+#else
+		size_t length = snprintf(text, sizeof(text), "%.9g", value);
+#endif
+
+		size_t mantissa = 0;
+		while (mantissa < length && text[mantissa] != '.' && text[mantissa] != 'e')
+			++mantissa;
+
+		if (mantissa == length || text[mantissa] == 'e')
+		{
+			memmove(text + mantissa + 2, text + mantissa, length - mantissa);
+			text[mantissa] = '.';
+			text[mantissa + 1] = '0';
+			length += 2;
+		}
+
+		write(text, length);
+	}
+
+	// Double quoted, the quotes, the backslashes and the control characters are escaped
+	void string(char const *data, size_t length)
+	{
+		put('"');
+
+		size_t done = 0;
+		for (size_t i = 0; i < length; ++i)
+		{
+			unsigned char const c = data[i];
+			if (c >= 0x20 && c != '"' && c != '\\' && c != 0x7f)
+				continue;
+
+			write(data + done, i - done);
+			escape(c);
+			done = i + 1;
+		}
+
+		write(data + done, length - done);
+		put('"');
+	}
+
+	void escape(unsigned char c)
+	{
+		char text[8] = {'\\', 0};
+		size_t length = 2;
+		switch (c)
+		{
+		case '"':
+		case '\\':
+			text[1] = c;
+			break;
+		case '\n':
+			text[1] = 'n';
+			break;
+		case '\r':
+			text[1] = 'r';
+			break;
+		case '\t':
+			text[1] = 't';
+			break;
+		default:
+			length = format_ == JSON
+				? snprintf(text, sizeof(text), "\\u%04x", c)
+				: snprintf(text, sizeof(text), "\\x%02x", c);
+			break;
+		}
+
+		write(text, length);
+	}
+
+	void pad(size_t indent)
+	{
+		memset(reserve(indent), ' ', indent);
+		used_ += indent;
+	}
+
+	void put(char c)
+	{
+		*reserve(1) = c;
+		++used_;
+	}
+
+	// Big pieces bypass the buffer
+	void write(char const *data, size_t size)
+	{
+		if (size > buffer_.size())
+		{
+			flush();
+			stream_.write(data, size);
+			return;
+		}
+
+		memcpy(reserve(size), data, size);
+		used_ += size;
+	}
+
+	char *reserve(size_t size)
+	{
+		if (used_ + size > buffer_.size())
+		{
+			flush();
+			if (size > buffer_.size())
+				buffer_.resize(size);
+		}
+
+		return &buffer_[0] + used_;
+	}
+
+	std::ostream &stream_;
+	Format const format_;
+	std::vector<char> buffer_;
+	size_t used_; // Bytes of the buffer waiting for the stream
+
+	Dumper(Dumper const &);
+	Dumper &operator =(Dumper const &);
+};
+
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef key_h_included
+#define key_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Key.h directly."
+#endif
+
+#include <cstring>
+#include <stdint.h>
+
+namespace rodb
+{
+
+// Map key with its length and hash computed up front.  Keys made from string literals with the
+// _key suffix are hashed at compile time:
+//
+//     using namespace rodb::literals;
+//     float x = root["ball"_key]["start_position"_key]["x"_key];
+//
+// Only maps with a hash table use the hash.  Keys made with lazy() hash on every call to hash()
+// instead, that's for keys that are looked up once.
+class Key
+{
+public:
+	constexpr Key(char const *data, size_t length):
+		data_(data),
+		length_(length),
+		hash_(hash(data, length)),
+		prefix_(prefix(data, length)),
+		hashed_(true)
+	{
+	}
+
+	explicit Key(char const *data):
+		data_(data),
+		length_(strlen(data)),
+		hash_(hash(data, length_)),
+		prefix_(prefix(data, length_)),
+		hashed_(true)
+	{
+	}
+
+	static Key lazy(char const *data)
+	{
+		return lazy(data, strlen(data));
+	}
+
+	static constexpr Key lazy(char const *data, size_t length)
+	{
+		return Key(data, length, false);
+	}
+
+	constexpr char const *data() const
+	{
+		return data_;
+	}
+
+	constexpr size_t length() const
+	{
+		return length_;
+	}
+
+	constexpr uint32_t hash() const
+	{
+		return hashed_ ? hash_ : hash(data_, length_);
+	}
+
+	constexpr uint64_t prefix() const
+	{
+		return prefix_;
+	}
+
+	// 32-bit FNV-1a.  The compilers use the same function to build map hash tables.
+	static constexpr uint32_t hash(char const *data, size_t length)
+	{
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < length; ++i)
+			hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+
+		return hash;
+	}
+
+	// The first 8 bytes padded with zeros, big endian, so comparing prefixes as integers is the
+	// same as comparing the keys as strings as long as the prefixes differ.
+	static constexpr uint64_t prefix(char const *data, size_t length)
+	{
+		uint64_t prefix = 0;
+		for (size_t i = 0; i < 8; ++i)
+			prefix = (prefix << 8) | (i < length ? static_cast<unsigned char>(data[i]) : 0);
+
+		return prefix;
+	}
+
+private:
+	constexpr Key(char const *data, size_t length, bool):
+		data_(data),
+		length_(length),
+		hash_(0),
+		prefix_(prefix(data, length)),
+		hashed_(false)
+	{
+	}
+
+	char const *data_;
+	size_t length_;
+	uint32_t hash_;
+	uint64_t prefix_;
+	bool hashed_;
+};
+
+namespace literals
+{
+
+constexpr Key operator "" _key(char const *data, size_t length)
+{
+	return Key(data, length);
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef loader_h_included
+#define loader_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Loader.h directly."
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rodb
+{
+
+// Loads databases on a pool of worker threads, so a batch of files is read in parallel and the
+// calling thread doesn't wait for the disk.  A worker reads one file at a time, so there are never
+// more reads in flight than workers, the rest wait in the queue in order.  The databases are
+// verified on the worker as well.  A load that fails throws from Future::get.
+//
+//     Loader loader(4);
+//     std::vector<Loader::Future> level = loader.load(level_files);
+//
+//     // Later, in the game loop
+//     if (level[0].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+//         tiles = level[0].get();
+class Loader
+{
+public:
+	typedef std::unique_ptr<Database> Pointer;
+	typedef std::future<Pointer> Future;
+
+	explicit Loader(size_t workers = 4): stopping_(false), busy_(0)
+	{
+		rodb_assert_or_throw(workers > 0, "Loader needs at least one worker");
+
+		for (size_t i = 0; i < workers; ++i)
+			workers_.push_back(std::thread(&Loader::work, this));
+	}
+
+	// Finishes the queued loads first
+	~Loader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+
+		wake_.notify_all();
+		for (size_t i = 0; i < workers_.size(); ++i)
+			workers_[i].join();
+	}
+
+	Future load(char const *filename, Database::Mode mode = Database::READ, Database::Check check = Database::CHECK_ALL)
+	{
+		Future future;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			future = enqueue(filename, mode, check);
+		}
+
+		wake_.notify_one();
+		return future;
+	}
+
+	// The futures are in the order of the files
+	std::vector<Future> load(std::vector<std::string> const &filenames, Database::Mode mode = Database::READ, Database::Check check = Database::CHECK_ALL)
+	{
+		std::vector<Future> futures;
+		futures.reserve(filenames.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (size_t i = 0; i < filenames.size(); ++i)
+				futures.push_back(enqueue(filenames[i].c_str(), mode, check));
+		}
+
+		wake_.notify_all();
+		return futures;
+	}
+
+	// Number of loads queued or in flight
+	size_t pending() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return queue_.size() + busy_;
+	}
+
+private:
+	struct Request
+	{
+		std::string filename;
+		Database::Mode mode;
+		Database::Check check;
+		std::promise<Pointer> promise;
+	};
+
+	Future enqueue(char const *filename, Database::Mode mode, Database::Check check)
+	{
+		queue_.push_back(Request());
+
+		Request &request = queue_.back();
+		request.filename = filename;
+		request.mode = mode;
+		request.check = check;
+
+		return request.promise.get_future();
+	}
+
+	void work()
+	{
+		for (;;)
+		{
+			Request request;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				while (queue_.empty() && !stopping_)
+					wake_.wait(lock);
+
+				if (queue_.empty())
+					return;
+
+				request = std::move(queue_.front());
+				queue_.pop_front();
+				++busy_;
+			}
+
+			Pointer database;
+			std::exception_ptr error;
+			try
+			{
+				database.reset(new Database(request.filename.c_str(), request.mode, request.check));
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+
+			// Not pending anymore once the future is ready
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				--busy_;
+			}
+
+			if (error)
+				request.promise.set_exception(error);
+			else
+				request.promise.set_value(std::move(database));
+		}
+	}
+
+	mutable std::mutex mutex_; // The queue and the counters
+	std::condition_variable wake_;
+	std::deque<Request> queue_;
+	bool stopping_;
+	size_t busy_;
+
+	std::vector<std::thread> workers_;
+
+	Loader(Loader const &);
+	Loader &operator =(Loader const &);
+};
+
+}
+
+#endif
@@ -0,0 +1,379 @@
+#ifndef overlay_h_included
+#define overlay_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Overlay.h directly."
+#endif
+
+#include <vector>
+
+namespace rodb
+{
+
+class OverlayValue;
+
+// A stack of databases seen as one, without copying or merging anything.  A map lookup goes
+// through the layers from the top down and the first layer that has the key wins.  When its value
+// is a map, the maps under the same key in the lower layers show through it.  Anything else hides
+// whatever is below, arrays are never merged.  A patch compiled with --patch deletes a key from
+// the layers below with a null value.
+//
+//     rodb::Database base("config.rodb");
+//     rodb::Database patch("config_ps4.rodb");
+//
+//     rodb::Overlay config;
+//     config.push(base);
+//     config.push(patch);
+//     int width = config["screen"]["width"];
+//
+// The databases must outlive the overlay and every value taken from it.
+class Overlay
+{
+public:
+	enum
+	{
+		MAX_LAYERS = 8,
+	};
+
+	Overlay(): count_(0)
+	{
+	}
+
+	// Goes on top of the layers pushed before
+	void push(Database const &layer)
+	{
+		rodb_assert_or_throw(count_ < MAX_LAYERS, "Too many overlay layers");
+		layers_[count_++] = &layer;
+	}
+
+	size_t layer_count() const
+	{
+		return count_;
+	}
+
+	OverlayValue root() const;
+
+	OverlayValue operator [](size_t index) const;
+	OverlayValue operator [](int index) const;
+	OverlayValue operator [](char const *key) const;
+	OverlayValue operator [](Key const &key) const;
+
+private:
+	Database const *layers_[MAX_LAYERS]; // Bottom to top
+	size_t count_;
+};
+
+// A value as seen through an overlay: the value from the topmost layer that has it and, when that's
+// a map, the maps at the same place in the layers below.  Lookups cost one map lookup per layer.
+class OverlayValue
+{
+public:
+	Value::Type type() const
+	{
+		return value_.type();
+	}
+
+	bool is_bool() const
+	{
+		return value_.is_bool();
+	}
+
+	bool is_int() const
+	{
+		return value_.is_int();
+	}
+
+	bool is_float() const
+	{
+		return value_.is_float();
+	}
+
+	bool is_string() const
+	{
+		return value_.is_string();
+	}
+
+	bool is_array() const
+	{
+		return value_.is_array();
+	}
+
+	bool is_map() const
+	{
+		return value_.is_map();
+	}
+
+	bool is_scalar() const
+	{
+		return value_.is_scalar();
+	}
+
+	bool is_compound() const
+	{
+		return value_.is_compound();
+	}
+
+	// The value from the topmost layer alone
+	Value const &value() const
+	{
+		return value_;
+	}
+
+	operator bool() const
+	{
+		return value_;
+	}
+
+	operator int() const
+	{
+		return value_;
+	}
+
+	operator unsigned() const
+	{
+		return value_;
+	}
+
+	operator float() const
+	{
+		return value_;
+	}
+
+	operator char const *() const
+	{
+		return value_;
+	}
+
+	// Merged maps have to walk the keys of every layer
+	size_t size() const
+	{
+		return is_map() ? merge_keys(0) : value_.size();
+	}
+
+	// Array only, arrays come from a single layer
+	OverlayValue operator [](size_t index) const
+	{
+		return OverlayValue(value_[index]);
+	}
+
+	OverlayValue operator [](int index) const
+	{
+		return operator []((size_t)index);
+	}
+
+	// Map only
+	bool has_key(char const *key) const
+	{
+		return has_key(Key::lazy(key));
+	}
+
+	bool has_key(Key const &key) const
+	{
+		rodb_assert_or_throw(is_map(), "Value is not a map");
+
+		for (size_t i = 0; i <= lower_count_; ++i)
+		{
+			Value const map = layer(i);
+			size_t const index = map.key_index(key);
+			if (index != Value::INVALID_INDEX)
+				return !map.values()[index].is_deleted();
+		}
+
+		return false;
+	}
+
+	// Map only, the keys of all the layers in sorted order without the deleted ones
+	std::vector<char const *> keys() const
+	{
+		rodb_assert_or_throw(is_map(), "Value is not a map");
+
+		std::vector<char const *> keys;
+		merge_keys(&keys);
+		return keys;
+	}
+
+	OverlayValue operator [](char const *key) const
+	{
+		return operator [](Key::lazy(key));
+	}
+
+	OverlayValue operator [](Key const &key) const
+	{
+		rodb_assert_or_throw(is_map(), "Value is not a map");
+
+		for (size_t i = 0; i <= lower_count_; ++i)
+		{
+			Value const map = layer(i);
+			size_t const index = map.key_index(key);
+			if (index == Value::INVALID_INDEX)
+				continue;
+
+			Value const value = map.values()[index];
+			rodb_assert_or_throw(!value.is_deleted(), "Key is not in the map");
+
+			OverlayValue result(value);
+			if (value.is_map())
+				result.add_lower(*this, i + 1, key);
+
+			return result;
+		}
+
+		throw std::runtime_error("Key is not in the map" rodb_location_info);
+	}
+
+private:
+	explicit OverlayValue(Value const &value): value_(value), lower_count_(0)
+	{
+	}
+
+	// 0 is the top
+	Value layer(size_t index) const
+	{
+		return index == 0 ? value_ : Value(lower_[index - 1], lower_types_[index - 1]);
+	}
+
+	// Collects the maps under the key in the layers of the parent from the given one down, until
+	// one of them has something else there
+	void add_lower(OverlayValue const &parent, size_t from, Key const &key)
+	{
+		for (size_t i = from; i <= parent.lower_count_; ++i)
+		{
+			Value const map = parent.layer(i);
+			size_t const index = map.key_index(key);
+			if (index == Value::INVALID_INDEX)
+				continue;
+
+			Value const value = map.values()[index];
+			if (!value.is_map())
+				break;
+
+			push_lower(value);
+		}
+	}
+
+	void push_lower(Value const &map)
+	{
+		lower_[lower_count_] = map.data_;
+		lower_types_[lower_count_] = map.element_type_; // Table rows are views
+		++lower_count_;
+	}
+
+	// Merges the sorted keys of the layers, the topmost layer decides whether a key is deleted.
+	// Returns the number of keys left.
+	size_t merge_keys(std::vector<char const *> *keys) const
+	{
+		size_t cursors[Overlay::MAX_LAYERS] = {0};
+		size_t count = 0;
+		while (true)
+		{
+			size_t top = Value::INVALID_INDEX;
+			for (size_t i = 0; i <= lower_count_; ++i)
+			{
+				if (cursors[i] == layer(i).size())
+					continue;
+
+				if (top == Value::INVALID_INDEX || compare(key_at(i, cursors[i]), key_at(top, cursors[top])) < 0)
+					top = i;
+			}
+
+			if (top == Value::INVALID_INDEX)
+				return count;
+
+			Value const key = key_at(top, cursors[top]);
+			bool const deleted = layer(top).values()[cursors[top]].is_deleted();
+			for (size_t i = 0; i <= lower_count_; ++i)
+				if (cursors[i] < layer(i).size() && compare(key_at(i, cursors[i]), key) == 0)
+					++cursors[i];
+
+			if (!deleted)
+			{
+				++count;
+				if (keys)
+					keys->push_back(key);
+			}
+		}
+	}
+
+	Value key_at(size_t layer_index, size_t index) const
+	{
+		return layer(layer_index).keys()[index];
+	}
+
+	static int compare(Value const &left, Value const &right)
+	{
+		return -left.compare_string(Key::lazy(right.string_data(), right.string_length()));
+	}
+
+	Value value_;
+	char const *lower_[Overlay::MAX_LAYERS - 1]; // Maps under value_ in the lower layers, top down
+	uint32_t lower_types_[Overlay::MAX_LAYERS - 1];
+	size_t lower_count_;
+
+	// BFF
+	friend class Overlay;
+};
+
+// Compares the topmost values, same as Value does
+template <typename T> inline bool operator ==(OverlayValue const &left, T const &right)
+{
+	return left.value() == right;
+}
+
+template <typename T> inline bool operator ==(T const &left, OverlayValue const &right)
+{
+	return left == right.value();
+}
+
+template <typename T> inline bool operator !=(OverlayValue const &left, T const &right)
+{
+	return !(left == right);
+}
+
+template <typename T> inline bool operator !=(T const &left, OverlayValue const &right)
+{
+	return !(left == right);
+}
+
+inline OverlayValue Overlay::root() const
+{
+	rodb_assert_or_throw(count_ > 0, "Overlay has no layers");
+
+	OverlayValue root(layers_[count_ - 1]->root());
+	if (root.is_map())
+	{
+		for (size_t i = count_ - 1; i > 0; --i)
+		{
+			Value const lower = layers_[i - 1]->root();
+			if (!lower.is_map())
+				break;
+
+			root.push_lower(lower);
+		}
+	}
+
+	return root;
+}
+
+inline OverlayValue Overlay::operator [](size_t index) const
+{
+	return root()[index];
+}
+
+inline OverlayValue Overlay::operator [](int index) const
+{
+	return root()[index];
+}
+
+inline OverlayValue Overlay::operator [](char const *key) const
+{
+	return root()[key];
+}
+
+inline OverlayValue Overlay::operator [](Key const &key) const
+{
+	return root()[key];
+}
+
+}
+
+#endif
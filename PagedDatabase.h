@@ -0,0 +1,738 @@
+#ifndef paged_database_h_included
+#define paged_database_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include PagedDatabase.h directly."
+#endif
+
+#include <algorithm>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef CONFIG_NO_PREAD
+#include <fstream>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+namespace rodb
+{
+
+class PagedValue;
+
+// A database that stays on disk.  The file is read in fixed-size pages when values reach them and
+// the pages are kept in an LRU cache of a fixed size, so only the touched subtrees are ever loaded
+// and the memory use doesn't depend on the size of the file.
+//
+//     rodb::PagedDatabase world("world.rodb", 32 << 20); // 32 MB of pages at most
+//     int tiles = world["regions"]["north"]["tiles"].size();
+//
+// Navigation works like it does with Value, but every access goes through the cache: the values
+// are copied out, strings included, and nothing points into the pages.  Map lookups compare the
+// keys right in the pages with a binary search over the sorted keys, the hash tables and Eytzinger
+// trees are not read.  Not thread safe, the cache is shared by all the values of the database.
+class PagedDatabase
+{
+public:
+	enum
+	{
+		DEFAULT_PAGE_SIZE = 16 * 1024,
+		DEFAULT_MEMORY_BUDGET = 16 * 1024 * 1024,
+	};
+
+	struct Statistics
+	{
+		size_t hits;       // Page lookups served from the cache
+		size_t misses;     // Pages read from the file
+		size_t evictions;  // Pages dropped to make room for others
+		size_t bytes_read; // From the file
+	};
+
+	// The budget is rounded down to whole pages and must fit at least one
+	PagedDatabase(char const *filename, size_t memory_budget = DEFAULT_MEMORY_BUDGET, size_t page_size = DEFAULT_PAGE_SIZE):
+		page_size_(page_size),
+		page_count_(page_size == 0 ? 0 : memory_budget / page_size),
+		size_(0),
+		used_frames_(0)
+	{
+		rodb_assert_or_throw(page_count_ > 0, "Memory budget is smaller than a page");
+		memset(&statistics_, 0, sizeof(statistics_));
+		frames_.resize(page_count_);
+
+		open_file(filename);
+
+		// The destructor is not called when the constructor throws
+		try
+		{
+			check_integriry();
+		}
+		catch (...)
+		{
+			close_file();
+			throw;
+		}
+	}
+
+	~PagedDatabase()
+	{
+		close_file();
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	size_t page_size() const
+	{
+		return page_size_;
+	}
+
+	// Most pages the cache holds at once
+	size_t page_count() const
+	{
+		return page_count_;
+	}
+
+	// Pages in the cache right now
+	size_t resident_pages() const
+	{
+		return resident_.size();
+	}
+
+	Statistics const &statistics() const
+	{
+		return statistics_;
+	}
+
+	void reset_statistics()
+	{
+		memset(&statistics_, 0, sizeof(statistics_));
+	}
+
+	PagedValue root();
+
+	PagedValue operator [](size_t index);
+	PagedValue operator [](int index);
+	PagedValue operator [](char const *key);
+	PagedValue operator [](Key const &key);
+
+private:
+	struct Frame
+	{
+		Frame(): page(INVALID_PAGE)
+		{
+		}
+
+		size_t page;
+		std::vector<char> data;
+		std::list<size_t>::iterator lru; // Position in lru_
+	};
+
+	static size_t const INVALID_PAGE = static_cast<size_t>(-1);
+
+	// Copies the bytes out of as many pages as they span
+	void read(size_t position, void *out, size_t size)
+	{
+		rodb_assert_or_throw(position <= size_ && size <= size_ - position, "Value is out of bounds");
+
+		char *cursor = static_cast<char *>(out);
+		while (size > 0)
+		{
+			size_t const page = position / page_size_;
+			size_t const offset = position % page_size_;
+			size_t const chunk = std::min(size, page_size_ - offset);
+
+			memcpy(cursor, &load(page)[offset], chunk);
+			cursor += chunk;
+			position += chunk;
+			size -= chunk;
+		}
+	}
+
+	// Same as memcmp(data, <the bytes at position>, size), without copying the bytes out
+	int compare(char const *data, size_t position, size_t size)
+	{
+		rodb_assert_or_throw(position <= size_ && size <= size_ - position, "Value is out of bounds");
+
+		while (size > 0)
+		{
+			size_t const page = position / page_size_;
+			size_t const offset = position % page_size_;
+			size_t const chunk = std::min(size, page_size_ - offset);
+
+			if (int const cmp = memcmp(data, &load(page)[offset], chunk))
+				return cmp;
+
+			data += chunk;
+			position += chunk;
+			size -= chunk;
+		}
+
+		return 0;
+	}
+
+	uint32_t u32(size_t position)
+	{
+		uint32_t value;
+		read(position, &value, sizeof(value));
+		return value;
+	}
+
+	// The least recently used page makes room when the cache is full
+	std::vector<char> const &load(size_t page)
+	{
+		std::unordered_map<size_t, size_t>::const_iterator const resident = resident_.find(page);
+		if (resident != resident_.end())
+		{
+			++statistics_.hits;
+			Frame &frame = frames_[resident->second];
+			lru_.splice(lru_.begin(), lru_, frame.lru);
+			return frame.data;
+		}
+
+		size_t index;
+		if (used_frames_ < page_count_)
+		{
+			index = used_frames_++;
+			frames_[index].lru = lru_.insert(lru_.begin(), index);
+		}
+		else
+		{
+			index = lru_.back();
+			lru_.splice(lru_.begin(), lru_, frames_[index].lru);
+			resident_.erase(frames_[index].page);
+			++statistics_.evictions;
+		}
+
+		// The frame stays empty when the read fails
+		Frame &frame = frames_[index];
+		frame.page = INVALID_PAGE;
+		frame.data.resize(std::min(page_size_, size_ - page * page_size_));
+		read_file(page * page_size_, &frame.data[0], frame.data.size());
+		frame.page = page;
+		resident_[page] = index;
+
+		++statistics_.misses;
+		statistics_.bytes_read += frame.data.size();
+		return frame.data;
+	}
+
+	// The same check as Database's
+	void check_integriry()
+	{
+		char header[sizeof(Database::Header)] = {};
+		read(0, header, std::min(size_, sizeof(header)));
+		Database::check_header(header, size_);
+	}
+
+#ifdef CONFIG_NO_PREAD
+	void open_file(char const *filename)
+	{
+		file_.open(filename, std::ios::binary);
+		if (file_.fail())
+			throw std::runtime_error("Cannot open input file");
+
+		file_.seekg(0, std::ios::end);
+		size_ = static_cast<size_t>(file_.tellg());
+	}
+
+	void read_file(size_t position, char *out, size_t size)
+	{
+		file_.seekg(position);
+		file_.read(out, size);
+		if (file_.fail())
+		{
+			file_.clear();
+			throw std::runtime_error("Cannot read input file");
+		}
+	}
+
+	void close_file()
+	{
+		file_.close();
+	}
+
+	std::ifstream file_;
+#else
+	void open_file(char const *filename)
+	{
+		fd_ = open(filename, O_RDONLY);
+		if (fd_ == -1)
+			throw std::runtime_error("Cannot open input file");
+
+		struct stat st;
+		if (fstat(fd_, &st) == -1)
+		{
+			close_file();
+			throw std::runtime_error("Cannot open input file");
+		}
+
+		size_ = st.st_size;
+	}
+
+	// A page is read with a single pread unless it's interrupted
+	void read_file(size_t position, char *out, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t const result = pread(fd_, out, size, position);
+			if (result < 0 && errno == EINTR)
+				continue;
+
+			if (result <= 0)
+				throw std::runtime_error("Cannot read input file");
+
+			out += result;
+			position += result;
+			size -= result;
+		}
+	}
+
+	void close_file()
+	{
+		if (fd_ != -1)
+			close(fd_);
+
+		fd_ = -1;
+	}
+
+	int fd_;
+#endif
+
+	size_t const page_size_;
+	size_t const page_count_;
+	size_t size_;
+	size_t used_frames_;
+	std::vector<Frame> frames_;
+	std::unordered_map<size_t, size_t> resident_; // Page to frame
+	std::list<size_t> lru_; // Frames, the most recently used first
+	Statistics statistics_;
+
+	PagedDatabase(PagedDatabase const &);
+	PagedDatabase &operator =(PagedDatabase const &);
+
+	// BFF
+	friend class PagedValue;
+};
+
+// A value of a PagedDatabase: the position in the file and the type word, everything else is read
+// through the page cache on access.  Always checked, a corrupted file throws instead of reading
+// outside of it.
+class PagedValue
+{
+public:
+	Value::Type type() const
+	{
+		if (element_type_ & Value::ROW_VIEW)
+			return Value::MAP;
+
+		if (element_type_ & Value::ROW_VALUES_VIEW)
+			return Value::ARRAY;
+
+		if (element_type_ != 0)
+			return static_cast<Value::Type>(element_type_);
+
+		return static_cast<Value::Type>((word_ & Value::TAG_MASK) | Value::LOWER_CASE);
+	}
+
+	bool is_bool() const
+	{
+		return type() == Value::BOOL;
+	}
+
+	bool is_int() const
+	{
+		return type() == Value::INT;
+	}
+
+	bool is_float() const
+	{
+		return type() == Value::FLOAT;
+	}
+
+	bool is_string() const
+	{
+		return type() == Value::STRING;
+	}
+
+	bool is_array() const
+	{
+		return type() == Value::ARRAY;
+	}
+
+	bool is_map() const
+	{
+		return type() == Value::MAP;
+	}
+
+	bool is_scalar() const
+	{
+		return is_bool() || is_int() || is_float() || is_string();
+	}
+
+	bool is_compound() const
+	{
+		return is_array() || is_map();
+	}
+
+	bool is_deleted() const
+	{
+		return type() == Value::DELETED;
+	}
+
+	bool is_packed() const
+	{
+		return is_array() && packed_type() != 0;
+	}
+
+	bool is_table() const
+	{
+		return is_array() && element_tag() == Value::MAP;
+	}
+
+	// Tables only, see Value::column
+	PagedValue column(char const *key) const
+	{
+		return column(Key::lazy(key));
+	}
+
+	PagedValue column(Key const &key) const
+	{
+		rodb_assert_or_throw(is_table(), "Value is not a table");
+
+		size_t const index = row(0).key_index(key);
+		rodb_assert_or_throw(index != Value::INVALID_INDEX, "Key is not in the table");
+
+		return columns()[index];
+	}
+
+	operator bool() const
+	{
+		rodb_assert_or_throw(is_bool(), "Value is not convertible to bool");
+		if (element_type_ != 0)
+		{
+			char value;
+			database_->read(position_, &value, 1);
+			return value != 0;
+		}
+
+		if (is_inline())
+			return (word_ >> 8) != 0;
+
+		return payload_u32(0) != 0;
+	}
+
+	operator int() const
+	{
+		rodb_assert_or_throw(is_int(), "Value is not convertible to int");
+		return static_cast<int>(bits());
+	}
+
+	operator unsigned() const
+	{
+		rodb_assert_or_throw(is_int(), "Value is not convertible to unsigned");
+		return static_cast<unsigned>(bits());
+	}
+
+	operator float() const
+	{
+		rodb_assert_or_throw(is_float(), "Value is not convertible to float");
+		uint32_t const value_bits = is_inline() ? word_ & ~static_cast<uint32_t>(Value::TAG_MASK) : bits();
+
+		float value;
+		memcpy(&value, &value_bits, sizeof(value));
+		return value;
+	}
+
+	// Strings are copied out of the pages
+	operator std::string() const
+	{
+		rodb_assert_or_throw(is_string(), "Value is not convertible to string");
+		if (is_inline())
+		{
+			char const data[] = {static_cast<char>(word_ >> 8), static_cast<char>(word_ >> 16), static_cast<char>(word_ >> 24), 0};
+			return data;
+		}
+
+		uint32_t const size = header_size();
+		rodb_assert_or_throw(size > 0, "String is not terminated");
+
+		std::string value(size - 1, '\0');
+		if (size > 1)
+			database_->read(position_ + NODE_HEADER_SIZE, &value[0], size - 1);
+
+		return value;
+	}
+
+	size_t size() const
+	{
+		if (is_scalar())
+			return 1;
+
+		if (is_view())
+			return PagedValue(*database_, position_ + NODE_HEADER_SIZE + 8).size();
+
+		return payload_u32(0);
+	}
+
+	// Array only
+	PagedValue operator [](size_t index) const
+	{
+		rodb_assert_or_throw(is_array(), "Value is not an array");
+		size_t const count = size();
+		rodb_assert_or_throw(index < count, "Index is out of bounds");
+
+		if (is_view())
+			return columns()[index][static_cast<size_t>(element_type_ & Value::ROW_MASK)];
+
+		if (is_table())
+			return row(index);
+
+		size_t const table = position_ + NODE_HEADER_SIZE + 4;
+		if (uint32_t const element_type = packed_type())
+			return PagedValue(*database_, table + index * (element_type == Value::BOOL ? 1 : 4), element_type);
+
+		int32_t const offset = static_cast<int32_t>(database_->u32(table + 4 * index));
+		return PagedValue(*database_, table + 4 * count + offset);
+	}
+
+	PagedValue operator [](int index) const
+	{
+		return operator []((size_t)index);
+	}
+
+	// Map only
+	bool has_key(char const *key) const
+	{
+		return key_index(Key::lazy(key)) != Value::INVALID_INDEX;
+	}
+
+	bool has_key(Key const &key) const
+	{
+		return key_index(key) != Value::INVALID_INDEX;
+	}
+
+	PagedValue keys() const
+	{
+		rodb_assert_or_throw(is_map(), "Value is not a map");
+		return PagedValue(*database_, position_ + NODE_HEADER_SIZE + 8);
+	}
+
+	PagedValue values() const
+	{
+		rodb_assert_or_throw(is_map(), "Value is not a map");
+		if (is_view())
+			return PagedValue(*database_, position_, Value::ROW_VALUES_VIEW | (element_type_ & Value::ROW_MASK));
+
+		return columns();
+	}
+
+	PagedValue operator [](char const *key) const
+	{
+		return operator [](Key::lazy(key));
+	}
+
+	PagedValue operator [](Key const &key) const
+	{
+		size_t const index = key_index(key);
+		rodb_assert_or_throw(index != Value::INVALID_INDEX, "Key is not in the map");
+
+		return values()[index];
+	}
+
+private:
+	// The rest of the format constants come from Value, this reads the same format
+	enum
+	{
+		NODE_HEADER_SIZE = 8,
+	};
+
+	PagedValue(PagedDatabase &database, size_t position): database_(&database), position_(position), word_(database.u32(position)), element_type_(0)
+	{
+		rodb_assert_or_throw(is_scalar() || is_deleted() || (is_compound() && !is_inline()), "Value must be scalar or compound");
+	}
+
+	// Packed array elements don't have a header, the type comes from the array
+	PagedValue(PagedDatabase &database, size_t position, uint32_t element_type): database_(&database), position_(position), word_(0), element_type_(element_type)
+	{
+	}
+
+	bool is_view() const
+	{
+		return element_type_ >= Value::ROW_VIEW;
+	}
+
+	PagedValue row(size_t index) const
+	{
+		return PagedValue(*database_, position_, Value::ROW_VIEW | static_cast<uint32_t>(index));
+	}
+
+	// The values of maps, the columns of tables
+	PagedValue columns() const
+	{
+		return PagedValue(*database_, position_ + NODE_HEADER_SIZE + 8 + payload_u32(4));
+	}
+
+	bool is_inline() const
+	{
+		return element_type_ == 0 && (word_ & Value::LOWER_CASE) == 0;
+	}
+
+	uint32_t element_tag() const
+	{
+		return element_type_ != 0 ? 0 : (word_ >> 8) & Value::TAG_MASK;
+	}
+
+	uint32_t packed_type() const
+	{
+		uint32_t const tag = element_tag();
+		return tag != Value::MAP ? tag : 0;
+	}
+
+	uint32_t header_size() const
+	{
+		return database_->u32(position_ + 4);
+	}
+
+	uint32_t payload_u32(size_t offset) const
+	{
+		return database_->u32(position_ + NODE_HEADER_SIZE + offset);
+	}
+
+	// Ints and floats
+	uint32_t bits() const
+	{
+		if (element_type_ != 0)
+			return database_->u32(position_);
+
+		if (is_inline())
+			return static_cast<uint32_t>(static_cast<int32_t>(word_) >> 8);
+
+		return payload_u32(0);
+	}
+
+	// Same as Value::compare_string, the bytes are compared right in the pages
+	int compare_string(Key const &key) const
+	{
+		rodb_assert_or_throw(is_string(), "Value is not convertible to string");
+
+		int cmp;
+		size_t length;
+		if (is_inline())
+		{
+			char const data[] = {static_cast<char>(word_ >> 8), static_cast<char>(word_ >> 16), static_cast<char>(word_ >> 24), 0};
+			length = strlen(data);
+			cmp = memcmp(key.data(), data, std::min(key.length(), length));
+		}
+		else
+		{
+			uint32_t const size = header_size();
+			rodb_assert_or_throw(size > 0, "String is not terminated");
+
+			length = size - 1;
+			cmp = database_->compare(key.data(), position_ + NODE_HEADER_SIZE, std::min(key.length(), length));
+		}
+
+		if (cmp != 0)
+			return cmp;
+
+		return key.length() < length ? -1 : (key.length() > length ? 1 : 0);
+	}
+
+	size_t key_index(Key const &key) const
+	{
+		rodb_assert_or_throw(is_map(), "Value is not a map");
+
+		PagedValue const k = keys();
+		size_t left = 0;
+		size_t right = k.size();
+		while (left < right)
+		{
+			size_t const middle = left + (right - left) / 2;
+			int const cmp = k[middle].compare_string(key);
+			if (cmp == 0)
+				return middle;
+
+			if (cmp < 0)
+				right = middle;
+			else
+				left = middle + 1;
+		}
+
+		return Value::INVALID_INDEX;
+	}
+
+	PagedDatabase *database_;
+	size_t position_; // From the beginning of the file
+	uint32_t word_;   // The type word, 0 for packed array elements and views
+	uint32_t element_type_;
+
+	// BFF
+	friend class PagedDatabase;
+};
+
+template <typename T> inline bool operator ==(PagedValue const &left, T right)
+{
+	return (T)left == right;
+}
+
+template <typename T> inline bool operator ==(T left, PagedValue const &right)
+{
+	return left == (T)right;
+}
+
+template <typename T> inline bool operator !=(PagedValue const &left, T right)
+{
+	return !(left == right);
+}
+
+template <typename T> inline bool operator !=(T left, PagedValue const &right)
+{
+	return !(left == right);
+}
+
+// Strings are compared as copies
+inline bool operator ==(PagedValue const &left, char const *right)
+{
+	return std::string(left) == right;
+}
+
+inline bool operator ==(char const *left, PagedValue const &right)
+{
+	return left == std::string(right);
+}
+
+inline PagedValue PagedDatabase::root()
+{
+	return PagedValue(*this, sizeof(Database::Header));
+}
+
+inline PagedValue PagedDatabase::operator [](size_t index)
+{
+	return root()[index];
+}
+
+inline PagedValue PagedDatabase::operator [](int index)
+{
+	return root()[index];
+}
+
+inline PagedValue PagedDatabase::operator [](char const *key)
+{
+	return root()[key];
+}
+
+inline PagedValue PagedDatabase::operator [](Key const &key)
+{
+	return root()[key];
+}
+
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef path_h_included
+#define path_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Path.h directly."
+#endif
+
+#include <cctype>
+#include <string>
+#include <vector>
+
+namespace rodb
+{
+
+// A chain of map keys and array indices parsed once, like "ball.start_position.x" or
+// "game.allowed_levels[5][1]".  The first evaluation walks the database, the value it ends up at
+// is remembered and later evaluations against the same database return it right away.  It's
+// looked up again when a different database comes in, a reloaded one included.
+//
+//     thread_local rodb::Path const speed("player.speed");
+//     float s = speed(db);
+//
+// Keys can't contain '.' or '['.  Not thread safe, the cache isn't updated atomically.  Every
+// thread needs its own copy, a thread_local or a member of an object only one thread uses.
+class Path
+{
+public:
+	explicit Path(char const *path): path_(path), instance_(0), data_(0), element_type_(0)
+	{
+		parse(path);
+	}
+
+	std::string const &str() const
+	{
+		return path_;
+	}
+
+	// Throws like Value does when the path doesn't exist in the database
+	Value operator ()(Database const &database) const
+	{
+		if (database.instance_ != instance_)
+			resolve(database);
+
+		return make_value(data_, element_type_);
+	}
+
+private:
+	struct Step
+	{
+		std::string key; // Empty for array indices
+		size_t index;
+	};
+
+	void parse(char const *path)
+	{
+		char const *p = path;
+		while (*p != 0)
+		{
+			Step step = {"", 0};
+			if (*p == '[')
+			{
+				char *end;
+				step.index = strtoul(p + 1, &end, 10);
+				rodb_assert_or_throw(isdigit(static_cast<unsigned char>(p[1])) && *end == ']', "Path is invalid");
+				p = end + 1;
+			}
+			else
+			{
+				// Keys follow the start, a '.' or an index
+				if (!steps_.empty())
+				{
+					rodb_assert_or_throw(*p == '.', "Path is invalid");
+					++p;
+				}
+
+				size_t const length = strcspn(p, ".[");
+				rodb_assert_or_throw(length > 0, "Path is invalid");
+				step.key.assign(p, length);
+				p += length;
+			}
+
+			steps_.push_back(step);
+		}
+	}
+
+	void resolve(Database const &database) const
+	{
+		instance_ = 0;
+
+		char const *data = database.root().data_;
+		uint32_t element_type = 0;
+		for (size_t i = 0; i < steps_.size(); ++i)
+		{
+			Step const &step = steps_[i];
+			Value const value = make_value(data, element_type);
+			Value const next = step.key.empty() ? value[step.index] : value[Key::lazy(step.key.data(), step.key.size())];
+			data = next.data_;
+			element_type = next.element_type_;
+		}
+
+		instance_ = database.instance_;
+		data_ = data;
+		element_type_ = element_type;
+	}
+
+	static Value make_value(char const *data, uint32_t element_type)
+	{
+		return element_type != 0 ? Value(data, element_type) : Value(data);
+	}
+
+	std::string path_;
+	std::vector<Step> steps_;
+
+	// The last resolution
+	mutable uint64_t instance_; // Of the database, 0 when not resolved
+	mutable char const *data_;
+	mutable uint32_t element_type_;
+};
+
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef profile_h_included
+#define profile_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Profile.h directly."
+#endif
+
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace rodb
+{
+
+// Access counters, only collected when CONFIG_PROFILE is defined in rodb.h.  Without it nothing is
+// recorded and the accessors don't have any extra code in them.
+//
+// Every thread counts into its own table, merge adds them up.  The counters are per node, keyed
+// by the node address: how many times the value was read or indexed, how many keys map lookups
+// compared in it and how many of its lookups didn't find the key.  dump walks a database and
+// prints the hottest nodes with their paths:
+//
+//     rodb::Profile::dump(db.root(), std::cerr);
+//
+//     accesses    probes    misses    offset  path
+//        40960    245760         0        56  player
+//        40960         0         0       312  player.speed
+class Profile
+{
+public:
+	struct Counters
+	{
+		Counters(): accesses(0), probes(0), misses(0)
+		{
+		}
+
+		uint64_t accesses; // Reads, index and key lookups
+		uint64_t probes;   // Keys compared by map lookups
+		uint64_t misses;   // Map lookups that didn't find the key
+	};
+
+	typedef std::unordered_map<void const *, Counters> Nodes;
+
+	struct Entry
+	{
+		std::string path; // Like "ball.start_position.x" or "levels[1]"
+		size_t offset;    // From the root
+		Counters counters;
+	};
+
+	// Nothing is counted on this thread while it exists, the walks in dump and Database::verify
+	// use it to stay out of the numbers
+	class Pause
+	{
+	public:
+		Pause()
+		{
+#ifdef CONFIG_PROFILE
+			++paused();
+#endif
+		}
+
+		~Pause()
+		{
+#ifdef CONFIG_PROFILE
+			--paused();
+#endif
+		}
+
+	private:
+		Pause(Pause const &);
+		Pause &operator =(Pause const &);
+	};
+
+	// The counters of all the threads added up, the threads keep counting
+	static Nodes merge()
+	{
+		Nodes total;
+
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		for (size_t i = 0; i < registry().size(); ++i)
+		{
+			ThreadCounters &thread = *registry()[i];
+			std::lock_guard<std::mutex> thread_lock(thread.mutex);
+			for (Nodes::const_iterator n = thread.nodes.begin(); n != thread.nodes.end(); ++n)
+			{
+				Counters &counters = total[n->first];
+				counters.accesses += n->second.accesses;
+				counters.probes += n->second.probes;
+				counters.misses += n->second.misses;
+			}
+		}
+
+		return total;
+	}
+
+	static void reset()
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		for (size_t i = 0; i < registry().size(); ++i)
+		{
+			std::lock_guard<std::mutex> thread_lock(registry()[i]->mutex);
+			registry()[i]->nodes.clear();
+		}
+	}
+
+	// The counted nodes under the root with their paths, the most accessed first.  A node
+	// shared by several paths (see --dedup) gets the first one.
+	template <typename C> static std::vector<Entry> hot_paths(BasicValue<C> const &root)
+	{
+		Pause pause;
+		Nodes const nodes = merge();
+
+		std::vector<Entry> entries;
+		std::unordered_set<void const *> visited;
+		std::string path;
+		collect(root, root.data_, nodes, visited, path, entries);
+
+		std::stable_sort(entries.begin(), entries.end(), hotter);
+		return entries;
+	}
+
+	template <typename C> static void dump(BasicValue<C> const &root, std::ostream &stream, size_t limit = 50)
+	{
+		std::vector<Entry> const entries = hot_paths(root);
+
+		stream << std::setw(10) << "accesses" << std::setw(10) << "probes" << std::setw(10) << "misses" << std::setw(10) << "offset" << "  path\n";
+		for (size_t i = 0; i < entries.size() && i < limit; ++i)
+		{
+			Entry const &e = entries[i];
+			stream
+				<< std::setw(10) << e.counters.accesses
+				<< std::setw(10) << e.counters.probes
+				<< std::setw(10) << e.counters.misses
+				<< std::setw(10) << e.offset
+				<< "  " << (e.path.empty() ? "(root)" : e.path) << "\n";
+		}
+	}
+
+	enum Event
+	{
+		ACCESS,
+		PROBE,
+		MISS,
+	};
+
+	static void record(void const *node, Event event)
+	{
+		if (paused() > 0)
+			return;
+
+		ThreadCounters &thread = local();
+		std::lock_guard<std::mutex> lock(thread.mutex);
+		Counters &counters = thread.nodes[node];
+		switch (event)
+		{
+		case ACCESS:
+			++counters.accesses;
+			break;
+
+		case PROBE:
+			++counters.probes;
+			break;
+
+		case MISS:
+			++counters.misses;
+			break;
+		}
+	}
+
+private:
+	// Only merge reads it from another thread, the lock is never contended otherwise
+	struct ThreadCounters
+	{
+		std::mutex mutex;
+		Nodes nodes;
+	};
+
+	// The registry keeps the counters of threads that are gone
+	static std::vector<std::shared_ptr<ThreadCounters> > &registry()
+	{
+		static std::vector<std::shared_ptr<ThreadCounters> > threads;
+		return threads;
+	}
+
+	static std::mutex &registry_mutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	static ThreadCounters &local()
+	{
+		thread_local std::shared_ptr<ThreadCounters> const counters = add_thread();
+		return *counters;
+	}
+
+	static std::shared_ptr<ThreadCounters> add_thread()
+	{
+		std::shared_ptr<ThreadCounters> const counters(new ThreadCounters);
+
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		registry().push_back(counters);
+		return counters;
+	}
+
+	static int &paused()
+	{
+		thread_local int paused = 0;
+		return paused;
+	}
+
+	template <typename C> static void collect(BasicValue<C> const &value, char const *root, Nodes const &nodes,
+		std::unordered_set<void const *> &visited, std::string &path, std::vector<Entry> &entries)
+	{
+		// Table rows are views of the table, they're counted as the table
+		if (!value.is_view())
+		{
+			if (!visited.insert(value.data_).second)
+				return;
+
+			Nodes::const_iterator const counters = nodes.find(value.data_);
+			if (counters != nodes.end())
+			{
+				Entry const entry = {path, static_cast<size_t>(value.data_ - root), counters->second};
+				entries.push_back(entry);
+			}
+		}
+
+		size_t const length = path.size();
+		if (value.is_array())
+		{
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				path += "[" + std::to_string(i) + "]";
+				collect(value[i], root, nodes, visited, path, entries);
+				path.resize(length);
+			}
+		}
+		else if (value.is_map())
+		{
+			BasicValue<C> const keys = value.keys();
+			BasicValue<C> const values = value.values();
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				path += (length > 0 ? "." : "") + std::string(static_cast<char const *>(keys[i]));
+				collect(values[i], root, nodes, visited, path, entries);
+				path.resize(length);
+			}
+		}
+	}
+
+	static bool hotter(Entry const &left, Entry const &right)
+	{
+		return left.counters.accesses > right.counters.accesses;
+	}
+};
+
+#ifdef CONFIG_PROFILE
+inline void profile_access(void const *node)
+{
+	Profile::record(node, Profile::ACCESS);
+}
+
+inline void profile_probe(void const *node)
+{
+	Profile::record(node, Profile::PROBE);
+}
+
+inline void profile_miss(void const *node)
+{
+	Profile::record(node, Profile::MISS);
+}
+#endif
+
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef span_h_included
+#define span_h_included
+
+#ifndef rodb_h_included
+#error "Please include rodb.h, don't include Span.h directly."
+#endif
+
+#include <cstddef>
+
+namespace rodb
+{
+
+// Elements of a packed array right in the database memory, see Value::as_span.  Valid as long as
+// the database is loaded.  The format doesn't align anything, so neither is the data.
+template <typename T> class Span
+{
+public:
+	Span(T const *data, size_t size): data_(data), size_(size)
+	{
+	}
+
+	T const *data() const
+	{
+		return data_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	bool empty() const
+	{
+		return size_ == 0;
+	}
+
+	T const *begin() const
+	{
+		return data_;
+	}
+
+	T const *end() const
+	{
+		return data_ + size_;
+	}
+
+	T const &operator [](size_t index) const
+	{
+		return data_[index];
+	}
+
+private:
+	T const *data_;
+	size_t size_;
+};
+
+}
+
+#endif
@@ -8,11 +8,20 @@
 #include <iostream>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
+#include <iterator>
 #include <stdint.h>
+#include <utility>
+#include <vector>
 
 namespace rodb
 {
-	
+
+class Compiler;
+class OverlayValue;
+class Path;
+class Profile;
+
 #define rodb_to_string_(s) #s
 #define rodb_to_string(s) rodb_to_string_(s)
 
@@ -22,18 +31,55 @@ namespace rodb
 #define rodb_location_info  " in " __FILE__ ", line " rodb_to_string(__LINE__)
 #endif
 
+#ifdef __GNUC__
+#define rodb_prefetch(p) __builtin_prefetch(p)
+#else
+#define rodb_prefetch(p) do { } while (false)
+#endif
+
+// Access counting, see Profile.h
+#ifdef CONFIG_PROFILE
+inline void profile_access(void const *node);
+inline void profile_probe(void const *node);
+inline void profile_miss(void const *node);
+#define rodb_profile(event, node) ::rodb::profile_##event(node)
+#else
+#define rodb_profile(event, node) do { } while (false)
+#endif
+
 #ifdef CONFIG_NO_EXCEPTIONS
 #define rodb_assert_or_throw(e, m) do { assert(e); } while(false)
 #else
 #define rodb_assert_or_throw(e, m) do { if (!(e)) throw std::runtime_error(m rodb_location_info); } while (false)
 #endif
 
-template <typename T> inline T const *offset_ptr(T const *p, size_t by)
+template <typename T> inline T const *offset_ptr(T const *p, ptrdiff_t by)
 {
 	return reinterpret_cast<T const *>(reinterpret_cast<char const *>(p) + by);
 }
 
-class Value
+// Value checks the type, the bounds and the structure on every access.  TrustedValue doesn't and
+// is meant for databases that passed Database::verify.  Reads still have to match the data though:
+// a wrong type, an index out of bounds or a missing key is undefined behaviour with it.
+struct CheckedAccess
+{
+	enum { ENABLED = true };
+};
+
+struct UncheckedAccess
+{
+	enum { ENABLED = false };
+};
+
+#define rodb_check(e, m) do { if (Checks::ENABLED) rodb_assert_or_throw(e, m); } while (false)
+
+// Element types of packed arrays, see Value::as_span
+template <typename T> struct PackedElement;
+template <> struct PackedElement<int32_t> { enum { TYPE = 'i' }; };
+template <> struct PackedElement<float> { enum { TYPE = 'f' }; };
+template <> struct PackedElement<bool> { enum { TYPE = 'b' }; };
+
+template <typename Checks> class BasicValue
 {
 public:
 	enum Type
@@ -45,13 +91,33 @@ public:
 
 		ARRAY = 'a',
 		MAP = 'm',
+
+		DELETED = 'd', // Patches only, see Overlay
 	};
 
 	static size_t const INVALID_INDEX = static_cast<size_t>(-1);
+
+	class ArrayIterator;
+	class MapIterator;
+	class MapItems;
+
+	typedef ArrayIterator iterator;
+	typedef ArrayIterator const_iterator;
 	
 	Type type() const
 	{
-		return static_cast<Type>(header().type_);
+		if (element_type_ != 0)
+		{
+			if (element_type_ & ROW_VIEW)
+				return MAP;
+
+			if (element_type_ & ROW_VALUES_VIEW)
+				return ARRAY;
+
+			return static_cast<Type>(element_type_);
+		}
+
+		return static_cast<Type>((header().type_ & TAG_MASK) | LOWER_CASE);
 	}
 	
 	bool is_bool() const
@@ -93,98 +159,574 @@ public:
 	{
 		return is_array() || is_map();
 	}
+
+	bool is_deleted() const
+	{
+		return type() == DELETED;
+	}
+
+	// Uniform int, float or bool arrays are stored as plain C arrays, see as_span
+	bool is_packed() const
+	{
+		return is_array() && packed_type() != 0;
+	}
+
+	// Arrays of maps with the same keys compiled with --columnar are stored column by column.
+	// They still work like any other array of maps, the rows are made on access.  See column.
+	bool is_table() const
+	{
+		return is_array() && element_tag() == MAP;
+	}
+
+	// Tables only: the values of one key in row order, a packed array when they're all ints,
+	// floats or bools.  Scanning a column doesn't touch the other keys:
+	//
+	//     Span<float> const x = spawns.column("x").as_span<float>();
+	BasicValue column(char const *key) const
+	{
+		return column(Key::lazy(key));
+	}
+
+	BasicValue column(Key const &key) const
+	{
+		rodb_profile(access, data_);
+		rodb_check(is_table(), "Value is not a table");
+
+		size_t const index = row(0).key_index(key);
+		rodb_check(index != INVALID_INDEX, "Key is not in the table");
+
+		return columns()[index];
+	}
+
+	// Packed arrays only: the elements without copying.  T is int32_t for ints, float or bool.
+	template <typename T> Span<T> as_span() const
+	{
+		rodb_profile(access, data_);
+		rodb_check(is_packed(), "Value is not a packed array");
+		rodb_check(packed_type() == PackedElement<T>::TYPE, "Packed array has a different type");
+		return Span<T>(static_cast<T const *>(payload(4)), size());
+	}
 	
 	operator bool() const
 	{
-		rodb_assert_or_throw(is_bool(), "Value is not convertible to bool");
+		rodb_profile(access, data_);
+		rodb_check(is_bool(), "Value is not convertible to bool");
+		if (element_type_ != 0)
+			return *data_ != 0;
+
+		if (is_inline())
+			return (header().type_ >> 8) != 0;
+
 		return *reinterpret_cast<int32_t const *>(payload()) != 0;
 	}
 	
 	operator int() const
 	{
-		rodb_assert_or_throw(is_int(), "Value is not convertible to int");
-		return static_cast<int>(*reinterpret_cast<int32_t const *>(payload()));
+		rodb_profile(access, data_);
+		rodb_check(is_int(), "Value is not convertible to int");
+		return static_cast<int>(int_bits());
 	}
 
 	operator unsigned() const
 	{
-		rodb_assert_or_throw(is_int(), "Value is not convertible to unsigned");
-		return static_cast<unsigned>(*reinterpret_cast<int32_t const *>(payload()));
+		rodb_profile(access, data_);
+		rodb_check(is_int(), "Value is not convertible to unsigned");
+		return static_cast<unsigned>(int_bits());
 	}
 
 	operator float() const
 	{
-		rodb_assert_or_throw(is_float(), "Value is not convertible to float");
+		rodb_profile(access, data_);
+		rodb_check(is_float(), "Value is not convertible to float");
+		if (element_type_ != 0)
+		{
+			float value;
+			memcpy(&value, data_, sizeof(value));
+			return value;
+		}
+
+		if (is_inline())
+		{
+			uint32_t const bits = header().type_ & ~static_cast<uint32_t>(TAG_MASK);
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
 		return *reinterpret_cast<float const *>(payload());
 	}
 
 	operator char const *() const
 	{
-		rodb_assert_or_throw(is_string(), "Value is not convertible to string");
-		return static_cast<char const *>(payload());
+		rodb_profile(access, data_);
+		rodb_check(is_string(), "Value is not convertible to string");
+		return string_data();
 	}
 
 	size_t size() const
 	{
-		return is_scalar() ? 1 : *reinterpret_cast<int32_t const *>(payload());
+		if (is_scalar())
+			return 1;
+
+		// Rows and their values have a key each
+		if (is_view())
+			return BasicValue(payload(8)).size();
+
+		return *reinterpret_cast<int32_t const *>(payload());
 	}
 
 	// Array only
-	Value operator [](size_t index) const
+	BasicValue operator [](size_t index) const
 	{
-		rodb_assert_or_throw(is_array(), "Value is not an array");
-		rodb_assert_or_throw(index < size(), "Index is out of bounds");
-		
+		rodb_profile(access, data_);
+		rodb_check(is_array(), "Value is not an array");
+		rodb_check(index < size(), "Index is out of bounds");
+
+		if (is_view())
+			return columns()[index][static_cast<size_t>(element_type_ & ROW_MASK)];
+
+		if (uint32_t const element_type = element_tag())
+		{
+			if (element_type == MAP)
+				return row(index);
+
+			return BasicValue(payload(4 + index * packed_size(element_type)), element_type);
+		}
+
 		int32_t const *offsets = reinterpret_cast<int32_t const *>(payload()) + 1;
-		return Value(offset_ptr(offsets + size(), offsets[index]));
+		return BasicValue(offset_ptr(offsets + size(), offsets[index]));
 	}
 
 	// The "int" version is for the "array[0]" situation.  With only "size_t" and "char const *"
 	// overloads there's an ambiguity problem.  It's very tidious to write "array[(int)0]" all the time.
-	Value operator [](int index) const
+	BasicValue operator [](int index) const
 	{
 		return operator []((size_t)index);
 	}
 
+	// Array only.  Random access, the iterators walk the offset table (or the packed elements)
+	// directly.
+	ArrayIterator begin() const
+	{
+		rodb_check(is_array(), "Value is not an array");
+
+		// Rows and row values are counted from the table
+		if (is_view())
+			return ArrayIterator(data_, data_, 1, element_type_);
+
+		if (is_table())
+			return ArrayIterator(data_, data_, 1, ROW_VIEW);
+
+		if (uint32_t const element_type = packed_type())
+			return ArrayIterator(static_cast<char const *>(payload(4)), 0, packed_size(element_type), element_type);
+
+		int32_t const *offsets = reinterpret_cast<int32_t const *>(payload()) + 1;
+		return ArrayIterator(reinterpret_cast<char const *>(offsets), reinterpret_cast<char const *>(offsets + size()), 4, 0);
+	}
+
+	ArrayIterator end() const
+	{
+		return begin() + size();
+	}
+
+	// Map only.  The key/value pairs in key order:
+	//
+	//     for (auto const &item: map.items())
+	//         std::cout << (char const *)item.first << "\n";
+	MapItems items() const
+	{
+		rodb_check(is_map(), "Value is not a map");
+		return MapItems(keys().begin(), values().begin(), size());
+	}
+
 	// Map only
 	bool has_key(char const *key) const
 	{
-		return key_index(key) != INVALID_INDEX;
+		return has_key(Key::lazy(key));
+	}
+
+	bool has_key(Key const &key) const
+	{
+		rodb_profile(access, data_);
+		if (key_index(key) == INVALID_INDEX)
+		{
+			rodb_profile(miss, data_);
+			return false;
+		}
+
+		return true;
+	}
+
+	BasicValue keys() const
+	{
+		rodb_check(is_map(), "Value is not a map");
+		return BasicValue(payload(8));
 	}
 
-	Value keys() const
+	BasicValue values() const
 	{
-		rodb_assert_or_throw(is_map(), "Value is not a map");
-		return Value(payload(8));
+		rodb_check(is_map(), "Value is not a map");
+		if (is_view())
+			return BasicValue(data_, ROW_VALUES_VIEW | (element_type_ & ROW_MASK));
+
+		return columns();
 	}
 
-	Value values() const
+	BasicValue operator [](char const *key) const
 	{
-		rodb_assert_or_throw(is_map(), "Value is not a map");
-		return Value(payload(8 + static_cast<uint32_t const *>(payload())[1]));
+		return operator [](Key::lazy(key));
 	}
 
-	Value operator [](char const *key) const
+	BasicValue operator [](Key const &key) const
 	{
-		rodb_assert_or_throw(is_map(), "Value is not a map");
+		rodb_profile(access, data_);
+		rodb_check(is_map(), "Value is not a map");
 		
 		size_t const index = key_index(key);
-		rodb_assert_or_throw(index != INVALID_INDEX, "Key is not in the map");
+		if (index == INVALID_INDEX)
+			rodb_profile(miss, data_);
+
+		rodb_check(index != INVALID_INDEX, "Key is not in the map");
 
 		return values()[index];
 	}
 
+	// Map only.  Looks up a batch of keys at once: the searches run side by side, one step of each
+	// in turn, and every step prefetches what the next one of the same search reads, so the cache
+	// misses of different keys overlap instead of following each other.  indices[i] is the index
+	// of batch[i] in keys() and values(), or INVALID_INDEX.
+	void lookup(Key const *batch, size_t count, size_t *indices) const
+	{
+		rodb_check(is_map(), "Value is not a map");
+
+		uint32_t const *table = map_section(HASH_SECTION);
+		uint32_t const *tree = table ? 0 : map_section(EYTZINGER_SECTION);
+		for (size_t i = 0; i < count; i += LOOKUP_GROUP)
+		{
+			size_t const group = count - i < LOOKUP_GROUP ? count - i : LOOKUP_GROUP;
+			if (table)
+				hashed_lookup(batch + i, group, indices + i, table);
+			else if (tree)
+				eytzinger_lookup(batch + i, group, indices + i, tree);
+			else
+				sorted_lookup(batch + i, group, indices + i);
+		}
+
+#ifdef CONFIG_PROFILE
+		for (size_t i = 0; i < count; ++i)
+		{
+			rodb_profile(access, data_);
+			if (indices[i] == INVALID_INDEX)
+				rodb_profile(miss, data_);
+		}
+#endif
+	}
+
+	// Same, appends the values to the vector.  Every key must be in the map.
+	void lookup(Key const *batch, size_t count, std::vector<BasicValue> &found) const
+	{
+		size_t indices[LOOKUP_GROUP];
+		BasicValue const v = values();
+		for (size_t i = 0; i < count; i += LOOKUP_GROUP)
+		{
+			size_t const group = count - i < LOOKUP_GROUP ? count - i : LOOKUP_GROUP;
+			lookup(batch + i, group, indices);
+			for (size_t j = 0; j < group; ++j)
+			{
+				rodb_check(indices[j] != INVALID_INDEX, "Key is not in the map");
+				found.push_back(v[indices[j]]);
+			}
+		}
+	}
+
+	// Arrays of maps only.  The first element with the int or string value under the field.  With
+	// an index on the field (see --index) it's a hash lookup, otherwise the elements are searched
+	// in order.
+	//
+	//     Value const sword = items.find_by("id", 4711);
+	BasicValue find_by(char const *field, int value) const
+	{
+		return find_by(Key(field), value);
+	}
+
+	BasicValue find_by(Key const &field, int value) const
+	{
+		size_t const index = find_index(field, value);
+		rodb_check(index != INVALID_INDEX, "Value is not in the array");
+
+		return operator [](index);
+	}
+
+	BasicValue find_by(char const *field, char const *value) const
+	{
+		return find_by(Key(field), Key(value));
+	}
+
+	BasicValue find_by(Key const &field, Key const &value) const
+	{
+		size_t const index = find_index(field, value);
+		rodb_check(index != INVALID_INDEX, "Value is not in the array");
+
+		return operator [](index);
+	}
+
+	// Same, the index of the element or INVALID_INDEX
+	size_t find_index(char const *field, int value) const
+	{
+		return find_index(Key(field), value);
+	}
+
+	size_t find_index(Key const &field, int value) const
+	{
+		uint32_t const bits = static_cast<uint32_t>(value);
+		char const bytes[] = {
+			static_cast<char>(bits),
+			static_cast<char>(bits >> 8),
+			static_cast<char>(bits >> 16),
+			static_cast<char>(bits >> 24),
+		};
+
+		return find_index(field, Key::hash(bytes, sizeof(bytes)), IntMatch(value));
+	}
+
+	size_t find_index(char const *field, char const *value) const
+	{
+		return find_index(Key(field), Key(value));
+	}
+
+	size_t find_index(Key const &field, Key const &value) const
+	{
+		return find_index(field, value.hash(), StringMatch(value));
+	}
+
 private:
 	struct Header
 	{
 		uint32_t type_;
 		uint32_t size_;
 	};
+
+	// Format v2 keeps small scalars in the type word itself: the tag in the lowest byte is upper
+	// case and the value takes the other three bytes.  That's bools, ints that fit in 24 bits,
+	// floats with the lowest 8 bits of the mantissa clear and strings of up to 2 characters.
+	enum
+	{
+		TAG_MASK = 0xff,
+		LOWER_CASE = 0x20,
+		INLINE_STRING_LENGTH = 2,
+	};
+
+	// Packed arrays have the element type in the second byte of the type word, the payload is
+	// the number of elements and the elements: 4 bytes per int or float, 1 byte per bool.
+	static size_t packed_size(uint32_t element_type)
+	{
+		return element_type == BOOL ? 1 : 4;
+	}
+
+	// Searches interleaved by lookup, enough to keep a few cache misses in flight
+	enum
+	{
+		LOOKUP_GROUP = 16,
+	};
+
+	// Maps may have optional sections after the values: tag, size of the data in bytes, data.
+	enum
+	{
+		HASH_SECTION = 0x68736168, // 'hash' in little endian
+		EYTZINGER_SECTION = 0x7a747965, // 'eytz' in little endian
+		EMPTY_SLOT = 0xffffffff,
+	};
+
+	// Indexed arrays have the flag in the type word and index sections after the elements, the
+	// last 4 bytes of the array are the size of the sections.  Tables keep theirs with the map
+	// sections.  An index is the length of the field name, the name padded to 4 bytes and a hash
+	// table like the one of maps with the element indices in the slots.
+	enum
+	{
+		INDEXED = 0x10000,
+		INDEX_SECTION = 0x78646e69, // 'indx' in little endian
+	};
+
+	class IntMatch
+	{
+	public:
+		explicit IntMatch(int value): value_(value)
+		{
+		}
+
+		bool operator ()(BasicValue const &value) const
+		{
+			return value.is_int() && (int)value == value_;
+		}
+
+	private:
+		int value_;
+	};
+
+	class StringMatch
+	{
+	public:
+		explicit StringMatch(Key const &value): value_(value)
+		{
+		}
+
+		bool operator ()(BasicValue const &value) const
+		{
+			return value.is_string() && value.equals_string(value_);
+		}
+
+	private:
+		Key const &value_;
+	};
+
+	template <typename Match> size_t find_index(Key const &field, uint32_t hash, Match const &match) const
+	{
+		rodb_profile(access, data_);
+		rodb_check(is_array(), "Value is not an array");
+
+		if (uint32_t const *table = index_section(field))
+		{
+			uint32_t const slot_count = table[0];
+			uint32_t const *slots = table + 1;
+			uint32_t slot = hash & (slot_count - 1);
+			for (uint32_t probe = 0; probe < slot_count; ++probe)
+			{
+				uint32_t const index = slots[2 * slot + 1];
+				if (index == EMPTY_SLOT)
+					break;
+
+				rodb_profile(probe, data_);
+				if (slots[2 * slot] == hash && element_matches(index, field, match))
+					return index;
+
+				slot = (slot + 1) & (slot_count - 1);
+			}
+
+			return INVALID_INDEX;
+		}
+
+		for (size_t i = 0; i < size(); ++i)
+		{
+			rodb_profile(probe, data_);
+			if (element_matches(i, field, match))
+				return i;
+		}
+
+		return INVALID_INDEX;
+	}
+
+	template <typename Match> bool element_matches(size_t index, Key const &field, Match const &match) const
+	{
+		BasicValue const element = operator [](index);
+		if (!element.is_map())
+			return false;
+
+		size_t const key = element.key_index(field);
+		return key != INVALID_INDEX && match(element.values()[key]);
+	}
+
+	// The hash table of the index on the field or 0
+	uint32_t const *index_section(Key const &field) const
+	{
+		char const *section;
+		char const *end = static_cast<char const *>(payload(header().size_));
+		if (is_table())
+		{
+			BasicValue const c = columns();
+			section = static_cast<char const *>(c.payload(c.header().size_));
+		}
+		else if (element_type_ == 0 && (header().type_ & INDEXED) != 0)
+		{
+			end -= 4;
+			uint32_t size;
+			memcpy(&size, end, sizeof(size));
+			section = end - size;
+		}
+		else
+		{
+			return 0;
+		}
+
+		while (section < end)
+		{
+			uint32_t const *s = reinterpret_cast<uint32_t const *>(section);
+			if (s[0] == INDEX_SECTION && s[2] == field.length() && memcmp(s + 3, field.data(), field.length()) == 0)
+				return s + 3 + (field.length() + 3) / 4;
+
+			section += 8 + s[1];
+		}
+
+		return 0;
+	}
 	
-	explicit Value(void const *data): data_(reinterpret_cast<char const *>(data))
+	explicit BasicValue(void const *data): data_(reinterpret_cast<char const *>(data)), element_type_(0)
 	{
 		assert(sizeof(Type) == 4); // TODO: This should be a static assert.
-		rodb_assert_or_throw(is_scalar() || is_compound(), "Value must be scalar or compound");
+		rodb_check(is_scalar() || is_deleted() || (is_compound() && !is_inline()), "Value must be scalar or compound");
+	}
+
+	// Packed array elements don't have a header, the type comes from the array
+	BasicValue(void const *data, uint32_t element_type): data_(reinterpret_cast<char const *>(data)), element_type_(element_type)
+	{
+	}
+
+	bool is_inline() const
+	{
+		return element_type_ == 0 && (header().type_ & LOWER_CASE) == 0;
+	}
+
+	// Tables are laid out like maps with the number of rows in place of the number of keys and
+	// a column for every key in place of the values.  Their rows, and the values of a row, are
+	// views: the table with the view and the row in element_type_.
+	enum
+	{
+		ROW_VIEW = 0x40000000,
+		ROW_VALUES_VIEW = 0x80000000,
+		ROW_MASK = 0x3fffffff,
+	};
+
+	bool is_view() const
+	{
+		return element_type_ >= ROW_VIEW;
+	}
+
+	BasicValue row(size_t index) const
+	{
+		return BasicValue(data_, ROW_VIEW | static_cast<uint32_t>(index));
+	}
+
+	// Arrays only: the element type of packed arrays, MAP for tables, 0 otherwise
+	uint32_t element_tag() const
+	{
+		return element_type_ != 0 ? 0 : (header().type_ >> 8) & TAG_MASK;
+	}
+
+	// Arrays only, 0 when not packed
+	uint32_t packed_type() const
+	{
+		uint32_t const tag = element_tag();
+		return tag != MAP ? tag : 0;
+	}
+
+	// The values of maps, the columns of tables
+	BasicValue columns() const
+	{
+		return BasicValue(payload(8 + static_cast<uint32_t const *>(payload())[1]));
+	}
+
+	int32_t int_bits() const
+	{
+		if (element_type_ != 0)
+		{
+			int32_t value;
+			memcpy(&value, data_, sizeof(value));
+			return value;
+		}
+
+		if (is_inline())
+			return static_cast<int32_t>(header().type_) >> 8;
+
+		return *reinterpret_cast<int32_t const *>(payload());
 	}
 
 	Header const &header() const
@@ -202,14 +744,259 @@ private:
 		return offset_ptr(header_ptr() + 1, extra_offset);
 	}
 
-	size_t key_index(char const *key) const
+	uint32_t const *map_section(uint32_t tag) const
 	{
+		BasicValue const v = columns();
+		char const *section = static_cast<char const *>(v.payload(v.header().size_));
+		char const *end = static_cast<char const *>(payload(header().size_));
+		while (section < end)
+		{
+			uint32_t const *s = reinterpret_cast<uint32_t const *>(section);
+			if (s[0] == tag)
+				return s + 2;
+
+			section += 8 + s[1];
+		}
+
+		return 0;
+	}
+
+	// Strings only
+	char const *string_data() const
+	{
+		return is_inline() ? data_ + 1 : static_cast<char const *>(payload());
+	}
+
+	// Strings only, the size in the header includes the terminator
+	size_t string_length() const
+	{
+		return is_inline() ? strlen(data_ + 1) : header().size_ - 1;
+	}
+
+	// Same as strcmp(key, *this), but doesn't need to look for the terminators
+	int compare_string(Key const &key) const
+	{
+		rodb_check(is_string(), "Value is not convertible to string");
+
+		size_t const length = string_length();
+		int const cmp = memcmp(key.data(), string_data(), key.length() < length ? key.length() : length);
+		if (cmp != 0)
+			return cmp;
+
+		return key.length() < length ? -1 : (key.length() > length ? 1 : 0);
+	}
+
+	// Rejects on the length before reading the bytes
+	bool equals_string(Key const &key) const
+	{
+		rodb_check(is_string(), "Value is not convertible to string");
+
+		size_t const length = string_length();
+		return length == key.length() && memcmp(key.data(), string_data(), length) == 0;
+	}
+
+	size_t key_index(Key const &key) const
+	{
+		if (uint32_t const *table = map_section(HASH_SECTION))
+			return hashed_key_index(key, table);
+
+		if (uint32_t const *tree = map_section(EYTZINGER_SECTION))
+			return eytzinger_key_index(key, tree);
+
+		return sorted_key_index(key);
+	}
+
+	// The table is a power of two number of slots followed by the slots.  Each slot is a hash
+	// and an index into keys() or EMPTY_SLOT.  Collisions are resolved with linear probing.
+	size_t hashed_key_index(Key const &key, uint32_t const *table) const
+	{
+		BasicValue const k = keys();
+		uint32_t const slot_count = table[0];
+		uint32_t const *slots = table + 1;
+		uint32_t const hash = key.hash();
+
+		uint32_t slot = hash & (slot_count - 1);
+		for (uint32_t probe = 0; probe < slot_count; ++probe)
+		{
+			uint32_t const index = slots[2 * slot + 1];
+			if (index == EMPTY_SLOT)
+				break;
+
+			rodb_profile(probe, data_);
+			if (slots[2 * slot] == hash && k[static_cast<size_t>(index)].equals_string(key))
+				return index;
+
+			slot = (slot + 1) & (slot_count - 1);
+		}
+
+		return INVALID_INDEX;
+	}
+
+	// The tree is the number of keys, the key prefixes (see Key::prefix) in Eytzinger order and the
+	// indices into keys() in the same order.  Node k has children 2k and 2k + 1, so the top levels
+	// share a few cache lines and the keys themselves are only read when the prefixes are equal.
+	size_t eytzinger_key_index(Key const &key, uint32_t const *tree) const
+	{
+		char const *prefixes = reinterpret_cast<char const *>(tree + 1);
+		size_t index = INVALID_INDEX;
+		for (size_t k = tree[0] > 0 ? 1 : 0; k != 0; k = eytzinger_step(key, tree, k, index))
+		{
+			// Eight prefixes per cache line, fetch the one three levels down
+			rodb_prefetch(prefixes + 8 * (8 * k - 1));
+		}
+
+		return index;
+	}
+
+	// Compares the key with node k.  Returns the child to go on with or 0 when the search is over,
+	// index is set when the key is found.
+	size_t eytzinger_step(Key const &key, uint32_t const *tree, size_t k, size_t &index) const
+	{
+		size_t const count = tree[0];
+		char const *prefixes = reinterpret_cast<char const *>(tree + 1);
+		uint32_t const *indices = reinterpret_cast<uint32_t const *>(prefixes + 8 * count);
+		uint64_t const prefix = key.prefix();
+
+		rodb_profile(probe, data_);
+		uint64_t node_prefix;
+		memcpy(&node_prefix, prefixes + 8 * (k - 1), sizeof(node_prefix));
+
+		if (node_prefix == prefix)
+		{
+			// Keys shorter than the prefix are fully contained in it
+			uint32_t const i = indices[k - 1];
+			if (key.length() < sizeof(prefix))
+			{
+				index = i;
+				return 0;
+			}
+
+			int const cmp = keys()[static_cast<size_t>(i)].compare_string(key);
+			if (cmp == 0)
+			{
+				index = i;
+				return 0;
+			}
+
+			k = 2 * k + (cmp > 0 ? 1 : 0);
+		}
+		else
+		{
+			k = 2 * k + (node_prefix < prefix ? 1 : 0);
+		}
+
+		return k <= count ? k : 0;
+	}
+
+	// Every search takes a step in turn and prefetches its next node for the next round
+	void eytzinger_lookup(Key const *batch, size_t count, size_t *indices, uint32_t const *tree) const
+	{
+		char const *prefixes = reinterpret_cast<char const *>(tree + 1);
+		size_t nodes[LOOKUP_GROUP];
+		for (size_t i = 0; i < count; ++i)
+		{
+			nodes[i] = tree[0] > 0 ? 1 : 0;
+			indices[i] = INVALID_INDEX;
+		}
+
+		for (bool searching = true; searching; )
+		{
+			searching = false;
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (nodes[i] == 0)
+					continue;
+
+				nodes[i] = eytzinger_step(batch[i], tree, nodes[i], indices[i]);
+				if (nodes[i] != 0)
+				{
+					rodb_prefetch(prefixes + 8 * (nodes[i] - 1));
+					searching = true;
+				}
+			}
+		}
+	}
+
+	// The first probed slot of every key is prefetched before any of them is probed
+	void hashed_lookup(Key const *batch, size_t count, size_t *indices, uint32_t const *table) const
+	{
+		uint32_t const slot_count = table[0];
+		uint32_t const *slots = table + 1;
+		for (size_t i = 0; i < count; ++i)
+			rodb_prefetch(slots + 2 * (batch[i].hash() & (slot_count - 1)));
+
+		for (size_t i = 0; i < count; ++i)
+			indices[i] = hashed_key_index(batch[i], table);
+	}
+
+	// Binary searches in lock step.  A probe reads the offset of the middle key and then the key,
+	// so the two are pipelined: a search prefetches the offset of its next middle as soon as it
+	// has compared, and the keys behind those offsets are prefetched for all the searches at the
+	// start of the next round, after the other searches have compared.
+	void sorted_lookup(Key const *batch, size_t count, size_t *indices) const
+	{
+		BasicValue const k = keys();
+		int32_t const *offsets = reinterpret_cast<int32_t const *>(k.payload()) + 1;
+		char const *elements = reinterpret_cast<char const *>(offsets + k.size());
+
+		size_t left[LOOKUP_GROUP];
+		size_t right[LOOKUP_GROUP];
+		for (size_t i = 0; i < count; ++i)
+		{
+			left[i] = 0;
+			right[i] = k.size();
+			indices[i] = INVALID_INDEX;
+			rodb_prefetch(offsets + right[i] / 2);
+		}
+
+		for (bool searching = true; searching; )
+		{
+			for (size_t i = 0; i < count; ++i)
+				if (left[i] < right[i])
+					rodb_prefetch(elements + offsets[left[i] + (right[i] - left[i]) / 2]);
+
+			searching = false;
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (left[i] >= right[i])
+					continue;
+
+				rodb_profile(probe, data_);
+				size_t const middle = left[i] + (right[i] - left[i]) / 2;
+				int const cmp = k[middle].compare_string(batch[i]);
+				if (cmp == 0)
+				{
+					indices[i] = middle;
+					right[i] = left[i];
+				}
+				else if (cmp < 0)
+				{
+					right[i] = middle;
+				}
+				else
+				{
+					left[i] = middle + 1;
+				}
+
+				if (left[i] < right[i])
+				{
+					rodb_prefetch(offsets + left[i] + (right[i] - left[i]) / 2);
+					searching = true;
+				}
+			}
+		}
+	}
+
+	size_t sorted_key_index(Key const &key) const
+	{
+		BasicValue const k = keys();
 		size_t left = 0;
-		size_t right = size();
+		size_t right = k.size();
 		while (left < right)
 		{
+			rodb_profile(probe, data_);
 			size_t const middle = left + (right - left) / 2;
-			int const cmp = strcmp(key, keys()[middle]);
+			int const cmp = k[middle].compare_string(key);
 
 			if (cmp == 0)
 				return middle;
@@ -224,56 +1011,370 @@ private:
 	}
 
 	char const *const data_;
+	uint32_t const element_type_; // Packed array elements and views only
+
+public:
+	// Points into the offset table of an array, elements are made on access.  Packed arrays have
+	// the elements themselves instead of the table.
+	class ArrayIterator
+	{
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef BasicValue value_type;
+		typedef ptrdiff_t difference_type;
+		typedef BasicValue reference; // Values are made on the fly, there's nothing to refer to
+		typedef void pointer;
+
+		ArrayIterator(): position_(0), table_end_(0), stride_(4), element_type_(0)
+		{
+		}
+
+		BasicValue operator *() const
+		{
+			if (element_type_ & ROW_VALUES_VIEW)
+				return BasicValue(table_end_, element_type_)[static_cast<size_t>(position_ - table_end_)];
+
+			if (element_type_ & ROW_VIEW)
+				return BasicValue(table_end_, ROW_VIEW | static_cast<uint32_t>(position_ - table_end_));
+
+			if (element_type_ != 0)
+				return BasicValue(position_, element_type_);
+
+			int32_t offset;
+			memcpy(&offset, position_, sizeof(offset));
+			return BasicValue(table_end_ + offset);
+		}
+
+		BasicValue operator [](difference_type n) const
+		{
+			return *(*this + n);
+		}
+
+		ArrayIterator &operator ++()
+		{
+			position_ += stride_;
+			return *this;
+		}
+
+		ArrayIterator operator ++(int)
+		{
+			ArrayIterator const i = *this;
+			position_ += stride_;
+			return i;
+		}
+
+		ArrayIterator &operator --()
+		{
+			position_ -= stride_;
+			return *this;
+		}
+
+		ArrayIterator operator --(int)
+		{
+			ArrayIterator const i = *this;
+			position_ -= stride_;
+			return i;
+		}
+
+		ArrayIterator &operator +=(difference_type n)
+		{
+			position_ += n * stride_;
+			return *this;
+		}
+
+		ArrayIterator &operator -=(difference_type n)
+		{
+			position_ -= n * stride_;
+			return *this;
+		}
+
+		ArrayIterator operator +(difference_type n) const
+		{
+			return ArrayIterator(*this) += n;
+		}
+
+		ArrayIterator operator -(difference_type n) const
+		{
+			return ArrayIterator(*this) -= n;
+		}
+
+		friend ArrayIterator operator +(difference_type n, ArrayIterator const &i)
+		{
+			return i + n;
+		}
+
+		difference_type operator -(ArrayIterator const &other) const
+		{
+			return (position_ - other.position_) / stride_;
+		}
+
+		bool operator ==(ArrayIterator const &other) const
+		{
+			return position_ == other.position_;
+		}
+
+		bool operator !=(ArrayIterator const &other) const
+		{
+			return position_ != other.position_;
+		}
+
+		bool operator <(ArrayIterator const &other) const
+		{
+			return position_ < other.position_;
+		}
+
+		bool operator >(ArrayIterator const &other) const
+		{
+			return position_ > other.position_;
+		}
+
+		bool operator <=(ArrayIterator const &other) const
+		{
+			return position_ <= other.position_;
+		}
+
+		bool operator >=(ArrayIterator const &other) const
+		{
+			return position_ >= other.position_;
+		}
+
+	private:
+		ArrayIterator(char const *position, char const *table_end, ptrdiff_t stride, uint32_t element_type):
+			position_(position),
+			table_end_(table_end),
+			stride_(stride),
+			element_type_(element_type)
+		{
+		}
+
+		char const *position_;  // Offset table entry, packed element or the table plus the index
+		char const *table_end_; // The offsets are relative to it, the table for views
+		ptrdiff_t stride_;
+		uint32_t element_type_; // Packed arrays and views only
+
+		// BFF
+		friend class BasicValue;
+	};
+
+	// Keys and values side by side, ordered by key
+	class MapIterator
+	{
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef std::pair<BasicValue, BasicValue> value_type;
+		typedef ptrdiff_t difference_type;
+		typedef value_type reference;
+		typedef void pointer;
+
+		MapIterator()
+		{
+		}
+
+		value_type operator *() const
+		{
+			return value_type(*keys_, *values_);
+		}
+
+		value_type operator [](difference_type n) const
+		{
+			return *(*this + n);
+		}
+
+		MapIterator &operator ++()
+		{
+			++keys_;
+			++values_;
+			return *this;
+		}
+
+		MapIterator operator ++(int)
+		{
+			MapIterator const i = *this;
+			++*this;
+			return i;
+		}
+
+		MapIterator &operator --()
+		{
+			--keys_;
+			--values_;
+			return *this;
+		}
+
+		MapIterator operator --(int)
+		{
+			MapIterator const i = *this;
+			--*this;
+			return i;
+		}
+
+		MapIterator &operator +=(difference_type n)
+		{
+			keys_ += n;
+			values_ += n;
+			return *this;
+		}
+
+		MapIterator &operator -=(difference_type n)
+		{
+			keys_ -= n;
+			values_ -= n;
+			return *this;
+		}
+
+		MapIterator operator +(difference_type n) const
+		{
+			return MapIterator(*this) += n;
+		}
+
+		MapIterator operator -(difference_type n) const
+		{
+			return MapIterator(*this) -= n;
+		}
+
+		friend MapIterator operator +(difference_type n, MapIterator const &i)
+		{
+			return i + n;
+		}
+
+		difference_type operator -(MapIterator const &other) const
+		{
+			return keys_ - other.keys_;
+		}
+
+		bool operator ==(MapIterator const &other) const
+		{
+			return keys_ == other.keys_;
+		}
+
+		bool operator !=(MapIterator const &other) const
+		{
+			return keys_ != other.keys_;
+		}
+
+		bool operator <(MapIterator const &other) const
+		{
+			return keys_ < other.keys_;
+		}
+
+		bool operator >(MapIterator const &other) const
+		{
+			return keys_ > other.keys_;
+		}
+
+		bool operator <=(MapIterator const &other) const
+		{
+			return keys_ <= other.keys_;
+		}
+
+		bool operator >=(MapIterator const &other) const
+		{
+			return keys_ >= other.keys_;
+		}
+
+	private:
+		MapIterator(ArrayIterator const &keys, ArrayIterator const &values): keys_(keys), values_(values)
+		{
+		}
+
+		ArrayIterator keys_;
+		ArrayIterator values_;
+
+		// BFF
+		friend class MapItems;
+	};
+
+	// What items() returns, a range for range-for and the algorithms
+	class MapItems
+	{
+	public:
+		MapIterator begin() const
+		{
+			return MapIterator(keys_, values_);
+		}
+
+		MapIterator end() const
+		{
+			return begin() + size_;
+		}
+
+		size_t size() const
+		{
+			return size_;
+		}
+
+	private:
+		MapItems(ArrayIterator const &keys, ArrayIterator const &values, size_t size): keys_(keys), values_(values), size_(size)
+		{
+		}
+
+		ArrayIterator keys_;
+		ArrayIterator values_;
+		size_t size_;
+
+		// BFF
+		friend class BasicValue;
+	};
+
+private:
 	
 	// BFF
 	friend class Database;
-	friend std::ostream &operator <<(std::ostream &stream, Value const &value);
+	friend class Compiler;
+	friend class Dumper;
+	friend class OverlayValue;
+	friend class PagedValue;
+	friend class Path;
+	friend class Profile;
 };
 
-template <typename T> inline bool operator ==(Value const &left, T right)
+typedef BasicValue<CheckedAccess> Value;
+typedef BasicValue<UncheckedAccess> TrustedValue;
+
+template <typename C, typename T> inline bool operator ==(BasicValue<C> const &left, T right)
 {
 	return (T)left == right;
 }
 
-template <typename T> inline bool operator ==(T left, Value const &right)
+template <typename C, typename T> inline bool operator ==(T left, BasicValue<C> const &right)
 {
 	return left == (T)right;
 }
 
-template <typename T> inline bool operator !=(Value const &left, T right)
+template <typename C, typename T> inline bool operator !=(BasicValue<C> const &left, T right)
 {
 	return !((T)left == right);
 }
 
-template <typename T> inline bool operator !=(T left, Value const &right)
+template <typename C, typename T> inline bool operator !=(T left, BasicValue<C> const &right)
 {
 	return !(left == (T)right);
 }
 
 // Used in ==(Value, Value)
-bool operator !=(Value const &left, Value const &right);
+template <typename C> bool operator !=(BasicValue<C> const &left, BasicValue<C> const &right);
 
 // Special handling for "Value == Value"
-inline bool operator ==(Value const &left, Value const &right)
+template <typename C> inline bool operator ==(BasicValue<C> const &left, BasicValue<C> const &right)
 {
 	if (left.type() != right.type())
 		return false;
 
 	switch (left.type())
 	{
-	case Value::BOOL:
+	case BasicValue<C>::BOOL:
 		return (bool)left == (bool)right;
 	
-	case Value::INT:
+	case BasicValue<C>::INT:
 		return (int)left == (int)right;
 	
-	case Value::FLOAT:
+	case BasicValue<C>::FLOAT:
 		return (float)left == (float)right;
 	
-	case Value::STRING:
+	case BasicValue<C>::STRING:
 		return strcmp(left, right) == 0;
 	
-	case Value::ARRAY:
+	case BasicValue<C>::ARRAY:
 		if (left.size() != right.size())
 			return false;
 		
@@ -283,31 +1384,34 @@ inline bool operator ==(Value const &left, Value const &right)
 
 		return true;
 
-	case Value::MAP:
+	case BasicValue<C>::MAP:
 		return left.keys() == right.keys() && left.values() == right.values();
+
+	case BasicValue<C>::DELETED:
+		return true;
 	}
 
 	throw std::runtime_error("The value is corrupted");
 }
 
 // Special handling for "Value == char const *"
-inline bool operator ==(Value const &left, char const *right)
+template <typename C> inline bool operator ==(BasicValue<C> const &left, char const *right)
 {
 	return strcmp(left, right) == 0;
 }
 
 // Special handling for "char const * == Value"
-inline bool operator ==(char const *left, Value const &right)
+template <typename C> inline bool operator ==(char const *left, BasicValue<C> const &right)
 {
 	return strcmp(left, right) == 0;
 }
 
-inline bool operator !=(Value const &left, Value const &right)
+template <typename C> inline bool operator !=(BasicValue<C> const &left, BasicValue<C> const &right)
 {
 	return !(left == right);
 }
 
-inline std::ostream &operator <<(std::ostream &stream, Value const &value)
+template <typename C> inline std::ostream &operator <<(std::ostream &stream, BasicValue<C> const &value)
 {
 	return stream
 		<< "Type: " << "'" << (char)value.type() << "'" << "\n"
@@ -0,0 +1,604 @@
+#include "Compiler.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <random>
+#include <set>
+
+namespace
+{
+
+char const *const RODB_FILENAME = "benchmark.rodb";
+
+void print_usage()
+{
+	std::cerr
+		<< "Usage: benchmark [options]\n"
+		<< "    --json             print the results as JSON\n"
+		<< "    --width N          keys per map (16)\n"
+		<< "    --length N         elements per array (64)\n"
+		<< "    --depth N          levels of nested maps (3)\n"
+		<< "    --string-size N    characters per string value (12)\n";
+}
+
+class Timer
+{
+public:
+	Timer(): start_(std::chrono::steady_clock::now())
+	{
+	}
+
+	double nanoseconds() const
+	{
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start_;
+};
+
+// Sorts the samples
+double percentile(std::vector<double> &samples, double p)
+{
+	std::sort(samples.begin(), samples.end());
+	return samples[static_cast<size_t>(p * (samples.size() - 1))];
+}
+
+std::string random_string(size_t length, std::mt19937 &random)
+{
+	std::uniform_int_distribution<int> letter('a', 'z');
+
+	std::string s(length, ' ');
+	for (size_t i = 0; i < length; ++i)
+		s[i] = static_cast<char>(letter(random));
+
+	return s;
+}
+
+std::vector<std::string> random_keys(size_t count, std::mt19937 &random)
+{
+	std::uniform_int_distribution<int> length(2, 15);
+
+	// The prefix keeps them from being YAML specials like yes, off or null
+	std::set<std::string> keys;
+	while (keys.size() < count)
+		keys.insert("k" + random_string(length(random), random));
+
+	return std::vector<std::string>(keys.begin(), keys.end());
+}
+
+//
+// Results
+//
+
+struct Result
+{
+	std::string benchmark;
+	std::string layout;
+	double value;
+	std::string unit;
+};
+
+class Results
+{
+public:
+	void add(std::string const &benchmark, std::string const &layout, double value, std::string const &unit)
+	{
+		Result const result = {benchmark, layout, value, unit};
+		results_.push_back(result);
+	}
+
+	void print_text(std::ostream &stream) const
+	{
+		stream << std::left << std::setw(32) << "benchmark" << std::setw(12) << "layout" << std::right << std::setw(16) << "value" << "  unit\n";
+		for (size_t i = 0; i < results_.size(); ++i)
+		{
+			Result const &r = results_[i];
+			stream
+				<< std::left << std::setw(32) << r.benchmark << std::setw(12) << r.layout
+				<< std::right << std::fixed << std::setprecision(2) << std::setw(16) << r.value << "  " << r.unit << "\n";
+		}
+	}
+
+	// One result per line, so the output diffs well between runs
+	void print_json(std::ostream &stream) const
+	{
+		stream << "[\n";
+		for (size_t i = 0; i < results_.size(); ++i)
+		{
+			Result const &r = results_[i];
+			stream
+				<< "  {\"benchmark\": \"" << r.benchmark << "\", \"layout\": \"" << r.layout << "\", "
+				<< "\"value\": " << std::fixed << std::setprecision(3) << r.value << ", \"unit\": \"" << r.unit << "\"}"
+				<< (i + 1 < results_.size() ? ",\n" : "\n");
+		}
+		stream << "]\n";
+	}
+
+private:
+	std::vector<Result> results_;
+};
+
+//
+// Synthetic configs
+//
+
+struct Shape
+{
+	Shape(): width(16), length(64), depth(3), string_size(12)
+	{
+	}
+
+	size_t width;       // Keys per map
+	size_t length;      // Elements per array
+	size_t depth;       // Levels of nested maps
+	size_t string_size; // Characters per string value
+};
+
+// Maps at every level have nested maps (except the deepest one), int arrays, string arrays and
+// scalars of all types in turns.  Counts the logical values on the way, keys included.
+class ConfigGenerator
+{
+public:
+	ConfigGenerator(Shape const &shape, std::mt19937 &random): shape_(shape), random_(random), values_(0)
+	{
+	}
+
+	std::string generate()
+	{
+		yaml_.clear();
+		values_ = 0;
+		map(0, "");
+		return yaml_;
+	}
+
+	size_t values() const
+	{
+		return values_;
+	}
+
+private:
+	void map(size_t level, std::string const &indent)
+	{
+		++values_;
+		std::vector<std::string> const keys = random_keys(shape_.width, random_);
+		for (size_t i = 0; i < keys.size(); ++i)
+		{
+			++values_;
+			yaml_ += indent + keys[i] + ":";
+
+			size_t const kind = i % 4;
+			if (kind == 0 && level + 1 < shape_.depth)
+			{
+				yaml_ += "\n";
+				map(level + 1, indent + "  ");
+			}
+			else if (kind == 1)
+			{
+				array(false);
+			}
+			else if (kind == 2)
+			{
+				array(true);
+			}
+			else
+			{
+				yaml_ += " " + scalar(i) + "\n";
+				++values_;
+			}
+		}
+	}
+
+	void array(bool strings)
+	{
+		++values_;
+		yaml_ += " [";
+		for (size_t i = 0; i < shape_.length; ++i)
+		{
+			++values_;
+			std::ostringstream item;
+			if (strings)
+				item << string();
+			else
+				item << static_cast<int>(random_() % 100000);
+
+			yaml_ += (i == 0 ? "" : ", ") + item.str();
+		}
+		yaml_ += "]\n";
+	}
+
+	std::string scalar(size_t i)
+	{
+		std::ostringstream s;
+		switch ((i / 4) % 4)
+		{
+		case 0: s << static_cast<int>(random_() % 100000); break;
+		case 1: s << (random_() % 100000) / 7.0; break;
+		case 2: s << (random_() % 2 ? "true" : "false"); break;
+		default: s << string(); break;
+		}
+
+		return s.str();
+	}
+
+	// Starts with "s" so it never resolves to a bool
+	std::string string()
+	{
+		return "s" + random_string(shape_.string_size > 0 ? shape_.string_size - 1 : 0, random_);
+	}
+
+	Shape shape_;
+	std::mt19937 &random_;
+	std::string yaml_;
+	size_t values_;
+};
+
+//
+// Whole config benchmarks
+//
+
+struct Layout
+{
+	char const *name;
+	bool hash_maps;
+	bool eytzinger_maps;
+	bool dedup;
+	uint32_t version;
+};
+
+Layout const LAYOUTS[] = {
+	{"sorted", false, false, false, 2},
+	{"eytzinger", false, true, false, 2},
+	{"hash", true, false, false, 2},
+	{"dedup", false, false, true, 2},
+	{"v1", false, false, false, 1},
+};
+
+void compile(std::string const &yaml, Layout const &layout)
+{
+	rodb::Compiler::Options options;
+	options.hash_maps = layout.hash_maps;
+	options.eytzinger_maps = layout.eytzinger_maps;
+	options.dedup = layout.dedup;
+	options.version = layout.version;
+
+	rodb::Compiler compiler(options);
+	compiler.parse(yaml.c_str(), yaml.size());
+	compiler.write_file(RODB_FILENAME);
+}
+
+template <typename V> struct Lookups
+{
+	std::vector<V> maps;
+	std::vector<std::string> keys;
+	std::vector<V> arrays;
+};
+
+// Collects every map with its keys and every non-empty array
+template <typename V> void collect(V const &value, Lookups<V> &lookups)
+{
+	if (value.is_map())
+	{
+		V const keys = value.keys();
+		for (size_t i = 0; i < value.size(); ++i)
+		{
+			lookups.maps.push_back(value);
+			lookups.keys.push_back(static_cast<char const *>(keys[i]));
+			collect(value.values()[i], lookups);
+		}
+	}
+	else if (value.is_array())
+	{
+		if (value.size() > 0)
+			lookups.arrays.push_back(value);
+
+		for (size_t i = 0; i < value.size(); ++i)
+			collect(value[i], lookups);
+	}
+}
+
+template <typename V> long traverse(V const &value)
+{
+	switch (value.type())
+	{
+	case V::BOOL:
+		return (bool)value ? 1 : 0;
+
+	case V::INT:
+		return (int)value;
+
+	case V::FLOAT:
+		return (float)value > 0 ? 1 : 0;
+
+	case V::STRING:
+		return *(char const *)value;
+
+	case V::DELETED:
+		return 0;
+
+	case V::ARRAY:
+		{
+			long sum = 0;
+			for (size_t i = 0; i < value.size(); ++i)
+				sum += traverse(value[i]);
+
+			return sum;
+		}
+
+	case V::MAP:
+		return traverse(value.keys()) + traverse(value.values());
+	}
+
+	return 0;
+}
+
+// Runs the loads a few times and keeps the median
+double time_load(rodb::Database::Mode mode, rodb::Database::Check check)
+{
+	std::vector<double> samples;
+	for (int i = 0; i < 9; ++i)
+	{
+		Timer timer;
+		rodb::Database db(RODB_FILENAME, mode, check);
+		samples.push_back(timer.nanoseconds());
+	}
+
+	return percentile(samples, 0.5);
+}
+
+// The lookups are timed in batches, a single one is too short for the clock
+size_t const BATCH_SIZE = 64;
+size_t const BATCHES = 4096;
+
+void benchmark_lookups(Lookups<rodb::Value> const &lookups, std::string const &layout, Results &results, std::mt19937 &random, long &checksum)
+{
+	std::vector<double> samples(BATCHES);
+	std::vector<size_t> order(BATCH_SIZE);
+
+	for (size_t b = 0; b < BATCHES; ++b)
+	{
+		for (size_t i = 0; i < BATCH_SIZE; ++i)
+			order[i] = random() % lookups.keys.size();
+
+		Timer timer;
+		for (size_t i = 0; i < BATCH_SIZE; ++i)
+			checksum += lookups.maps[order[i]][lookups.keys[order[i]].c_str()].type();
+
+		samples[b] = timer.nanoseconds() / BATCH_SIZE;
+	}
+
+	results.add("key_lookup_p50", layout, percentile(samples, 0.5), "ns");
+	results.add("key_lookup_p99", layout, percentile(samples, 0.99), "ns");
+
+	if (lookups.arrays.empty())
+		return;
+
+	std::vector<size_t> indices(BATCH_SIZE);
+	for (size_t b = 0; b < BATCHES; ++b)
+	{
+		for (size_t i = 0; i < BATCH_SIZE; ++i)
+		{
+			order[i] = random() % lookups.arrays.size();
+			indices[i] = random() % lookups.arrays[order[i]].size();
+		}
+
+		Timer timer;
+		for (size_t i = 0; i < BATCH_SIZE; ++i)
+			checksum += lookups.arrays[order[i]][indices[i]].type();
+
+		samples[b] = timer.nanoseconds() / BATCH_SIZE;
+	}
+
+	results.add("array_index_p50", layout, percentile(samples, 0.5), "ns");
+	results.add("array_index_p99", layout, percentile(samples, 0.99), "ns");
+}
+
+void benchmark_configs(Shape const &shape, Results &results, long &checksum)
+{
+	std::mt19937 random(42);
+	ConfigGenerator generator(shape, random);
+	std::string const yaml = generator.generate();
+	double const values = static_cast<double>(generator.values());
+
+	results.add("yaml_bytes", "-", static_cast<double>(yaml.size()), "bytes");
+	results.add("values", "-", values, "values");
+
+	for (size_t l = 0; l < sizeof(LAYOUTS) / sizeof(LAYOUTS[0]); ++l)
+	{
+		std::string const layout = LAYOUTS[l].name;
+		compile(yaml, LAYOUTS[l]);
+
+		rodb::Database db(RODB_FILENAME);
+		results.add("blob_bytes", layout, static_cast<double>(db.size()), "bytes");
+		results.add("bytes_per_value", layout, db.size() / values, "bytes");
+
+		results.add("load_read", layout, time_load(rodb::Database::READ, rodb::Database::CHECK_HEADER) / 1000, "us");
+		results.add("load_map", layout, time_load(rodb::Database::MAP, rodb::Database::CHECK_HEADER) / 1000, "us");
+		results.add("load_read_verify", layout, time_load(rodb::Database::READ, rodb::Database::CHECK_ALL) / 1000, "us");
+
+		Lookups<rodb::Value> lookups;
+		collect(db.root(), lookups);
+		benchmark_lookups(lookups, layout, results, random, checksum);
+
+		{
+			Timer timer;
+			checksum += traverse(db.root());
+			results.add("traverse", layout, values / timer.nanoseconds() * 1000, "Mvalues/s");
+		}
+
+		db.verify();
+		{
+			Timer timer;
+			checksum += traverse(db.trusted_root());
+			results.add("traverse_trusted", layout, values / timer.nanoseconds() * 1000, "Mvalues/s");
+		}
+
+		{
+			std::ostringstream out;
+			Timer timer;
+			db.dump_yaml(out);
+			results.add("dump_yaml", layout, out.str().size() / timer.nanoseconds() * 1000, "MB/s");
+		}
+
+		{
+			std::ostringstream out;
+			Timer timer;
+			db.dump_json(out);
+			results.add("dump_json", layout, out.str().size() / timer.nanoseconds() * 1000, "MB/s");
+		}
+	}
+
+	remove(RODB_FILENAME);
+}
+
+//
+// Map lookups in different layouts
+//
+
+std::string map_yaml(std::vector<std::string> const &keys)
+{
+	std::string yaml;
+	for (size_t i = 0; i < keys.size(); ++i)
+	{
+		std::ostringstream line;
+		line << keys[i] << ": " << i << "\n";
+		yaml += line.str();
+	}
+
+	return yaml;
+}
+
+template <typename K> double time_lookups(rodb::Value const &map, std::vector<K> const &keys, size_t lookups, long &checksum)
+{
+	Timer timer;
+	for (size_t i = 0; i < lookups; ++i)
+		checksum += static_cast<int>(map[keys[i % keys.size()]]);
+
+	return timer.nanoseconds() / lookups;
+}
+
+// Value::lookup in groups of keys, like reading the settings of an entity
+double time_batch_lookups(rodb::Value const &map, std::vector<rodb::Key> const &keys, size_t lookups, long &checksum)
+{
+	size_t const group = 32;
+	size_t indices[group];
+
+	Timer timer;
+	for (size_t i = 0; i + group <= lookups; i += group)
+	{
+		map.lookup(&keys[i % (keys.size() - keys.size() % group)], group, indices);
+		checksum += indices[0];
+	}
+
+	return timer.nanoseconds() / lookups;
+}
+
+void benchmark_map_layouts(Results &results, long &checksum)
+{
+	size_t const sizes[] = {16, 256, 65536};
+	size_t const lookups = 2000000;
+	std::mt19937 random(42);
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+	{
+		std::vector<std::string> const keys = random_keys(sizes[s], random);
+		std::string const yaml = map_yaml(keys);
+
+		// Look the keys up in a random order
+		std::vector<size_t> order(lookups < keys.size() * 16 ? lookups : keys.size() * 16);
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = random() % keys.size();
+
+		std::vector<char const *> c_keys(order.size());
+		std::vector<rodb::Key> pre_hashed_keys;
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			c_keys[i] = keys[order[i]].c_str();
+			pre_hashed_keys.push_back(rodb::Key(c_keys[i]));
+		}
+
+		std::ostringstream name;
+		name << "map_" << keys.size() << "_keys_";
+
+		for (size_t l = 0; l < 3; ++l)
+		{
+			compile(yaml, LAYOUTS[l]);
+
+			rodb::Database db(RODB_FILENAME);
+			rodb::Value const map = db.root();
+
+			results.add(name.str() + "char", LAYOUTS[l].name, time_lookups(map, c_keys, lookups, checksum), "ns");
+			results.add(name.str() + "key", LAYOUTS[l].name, time_lookups(map, pre_hashed_keys, lookups, checksum), "ns");
+			results.add(name.str() + "batch", LAYOUTS[l].name, time_batch_lookups(map, pre_hashed_keys, lookups, checksum), "ns");
+			results.add(name.str() + "bytes_per_key", LAYOUTS[l].name, static_cast<double>(db.size()) / keys.size(), "bytes");
+		}
+	}
+
+	remove(RODB_FILENAME);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	Shape shape;
+	bool json = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--json") == 0)
+		{
+			json = true;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+		{
+			print_usage();
+			return 1;
+		}
+
+		size_t const value = strtoul(argv[i + 1], 0, 10);
+		if (strcmp(argv[i], "--width") == 0 && value > 0)
+			shape.width = value;
+		else if (strcmp(argv[i], "--length") == 0)
+			shape.length = value;
+		else if (strcmp(argv[i], "--depth") == 0 && value > 0)
+			shape.depth = value;
+		else if (strcmp(argv[i], "--string-size") == 0 && value > 0)
+			shape.string_size = value;
+		else
+		{
+			print_usage();
+			return 1;
+		}
+
+		++i;
+	}
+
+	try
+	{
+		Results results;
+		long checksum = 0;
+
+		benchmark_configs(shape, results, checksum);
+		benchmark_map_layouts(results, checksum);
+
+		if (json)
+			results.print_json(std::cout);
+		else
+			results.print_text(std::cout);
+
+		// Keeps the lookups from being optimized away
+		if (checksum == 42)
+			std::cerr << "\n";
+	}
+	catch (std::exception const &e)
+	{
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
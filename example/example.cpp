@@ -1,12 +1,15 @@
 #include "../rodb.h"
 
+using namespace rodb::literals;
+
 struct Point
 {
     Point(int x, int y): x(x), y(y)
     {
     }
 
-    Point(rodb::Value const &v): x(v["x"]), y(v["y"])
+    // Keys with the _key suffix are hashed at compile time.
+    Point(rodb::Value const &v): x(v["x"_key]), y(v["y"_key])
     {
     }
 
@@ -47,6 +50,12 @@ int main(int argc, char **argv)
     Point p1(root["ball"]["start_position"]["x"], root["ball"]["start_position"]["y"]);
     Point p2(root["ball"]["start_position"]);
     assert(p1.x == p2.x && p1.y == p2.y);
+
+    // Or let a path do it. It walks the database once and remembers where it ended up,
+    // evaluating it again with the same database costs nothing. It's not thread safe,
+    // so every thread gets its own.
+    thread_local rodb::Path const start_x("ball.start_position.x");
+    assert(start_x(db) == p1.x);
     std::cout << "Point: {" << p1.x << ", " << p1.y << "}\n";
 
     // Boolean values.
@@ -3,8 +3,22 @@
 
 //#define CONFIG_NO_LOCATION_INFO
 //#define CONFIG_NO_EXCEPTIONS
+//#define CONFIG_NO_MMAP
+//#define CONFIG_NO_PREAD
+//#define CONFIG_PROFILE
 
+#include "Key.h"
+#include "Span.h"
 #include "Value.h"
+#include "Profile.h"
+#include "Dumper.h"
+#include "Allocator.h"
 #include "Database.h"
+#include "DatabaseHandle.h"
+#include "Path.h"
+#include "Overlay.h"
+#include "PagedDatabase.h"
+#include "Loader.h"
+#include "Delta.h"
 
 #endif
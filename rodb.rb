@@ -1,31 +1,155 @@
+require 'digest'
+require 'fileutils'
 require 'yaml'
 
 module Rodb
+	# Options:
+	#   :hash_maps      - emit a hash table for every non-empty map to speed up key lookups
+	#   :eytzinger_maps - emit the key prefixes of every non-empty map in Eytzinger order
+	#   :dedup          - store identical strings and subtrees only once, the duplicates refer to
+	#                     the first copy
+	#   :patch          - compile an overlay patch, nil map values delete the key from the layers
+	#                     below (see rodb::Overlay)
+	#   :version        - format version, 1 is readable by older readers but has no inline scalars
+	#   :profile        - hot paths and their weights (see Rodb.load_profile).  The hot nodes and
+	#                     their ancestors are written first, depth first, the cold subtrees follow
+	#                     them, so the working set takes fewer pages and cache lines.
+	#   :columnar       - store arrays of two or more maps with the same keys as tables: the keys
+	#                     once and a column of values per key (see rodb::Value::is_table)
+	#   :indexes        - paths of arrays of maps and the fields to index them by, like
+	#                     {'items' => ['id']}.  The int and string values of the fields are hashed
+	#                     (see rodb::Value::find_by).
+	#   :cache          - directory of compiled YAML and subtrees, keyed by the SHA-256 of their
+	#                     content and the options.  An unchanged file is read back without parsing,
+	#                     in a changed one the big subtrees that haven't changed are copied from
+	#                     the cache.  With :dedup, :profile or :indexes the encoding of a subtree
+	#                     depends on the rest of the file, so only whole files are cached then.
+	#
+	# The blob is written into a single buffer, array offsets and sizes are patched in once the
+	# items are written.
 	class Compiler
+		# :duplicates   - number of values replaced with a reference to an identical one
+		# :saved_bytes  - how much smaller the blob is compared to the one without deduplication
+		# :cached_bytes - how much of the blob came from the cache
+		attr_reader :stats
+
+		def initialize(options = {})
+			@options = options
+			@version = options[:version] || VERSION
+		end
+
 		def compile(yaml)
-			header + dump_value(load_yaml(yaml))
+			@stats = {:duplicates => 0, :saved_bytes => 0, :cached_bytes => 0}
+			if @options[:cache]
+				yaml = yaml.read if yaml.respond_to? :read
+				key = cache_key 'file', yaml
+				if @out = cache_read(key)
+					@stats[:cached_bytes] = @out.length
+					return @out
+				end
+				@subtrees = !@options[:dedup] && !@options[:profile] && !@options[:indexes]
+			end
+
+			@out = header
+			@positions = {}
+			@ids = {}
+			@node_ids = {}.compare_by_identity
+			@tables = {}.compare_by_identity
+			@indexes = {}.compare_by_identity
+			@full_sizes = []
+			@hot = hot_paths @options[:profile] if @options[:profile]
+			@deferred = []
+
+			root = load_yaml yaml
+			collect_indexes root, '', {}.compare_by_identity if @options[:indexes] && @version >= 2
+			dump_value root, @hot && ''
+			@deferred.each do |item, slot, base|
+				patch slot, dump_reference(item) - base
+			end
+			cache_write key, @out if key
+			@out
 		end
 
 	private
-		VERSION = 1
+		VERSION = 2
+		EMPTY_SLOT = 0xffffffff
+		INDEXED = 0x10000
+		INLINE_STRING_LENGTH = 2
+		CACHE_MIN_SIZE = 4096 # Smaller subtrees are compiled every time
 
 		def header
-			['rodb', VERSION].pack "a4V"
+			['rodb', @version].pack "a4V"
 		end
 
 		def dump_binary(type, payload)
-			[type, payload.length].pack('a4V') + payload
+			@out << [type, payload.length].pack('a4V') << payload
+		end
+
+		# The size is patched in by end_binary
+		def begin_binary(type)
+			start = @out.length
+			@out << [type, 0].pack('a4V')
+			start
+		end
+
+		def end_binary(start)
+			patch start + 4, @out.length - start - 8
+		end
+
+		def patch(position, value)
+			@out[position, 4] = [value].pack('V')
+		end
+
+		# Optional map sections follow the values: tag, size of the data, data
+		def dump_section(tag, data)
+			[tag, data.length].pack('a4V') + data
 		end
 
-		def offsets(items)
-			sum = 0
-			offsets = []
-			items.map { |i| i.length }.each_with_index do |i, index|
-				offsets << sum
-				sum += i
+		# Open addressing with linear probing, at most half of the slots are used
+		def hash_slot_count(count)
+			slot_count = 1
+			slot_count *= 2 while slot_count < count * 2
+			slot_count
+		end
+
+		def dump_hash_table(keys)
+			slot_count = hash_slot_count keys.length
+			slots = Array.new(slot_count) { [0, EMPTY_SLOT] }
+			keys.each_with_index do |key, index|
+				hash = Rodb.hash_key key
+				slot = hash & (slot_count - 1)
+				slot = (slot + 1) & (slot_count - 1) until slots[slot][1] == EMPTY_SLOT
+				slots[slot] = [hash, index]
+			end
+
+			dump_section 'hash', [slot_count].pack('V') + slots.flatten.pack('V*')
+		end
+
+		# Positions of the sorted keys in a 1-based Eytzinger layout, node k has children 2k and 2k + 1
+		def eytzinger_order(count)
+			order = []
+			sorted_index = 0
+			visit = lambda do |k|
+				if k <= count
+					visit.call 2 * k
+					order[k - 1] = sorted_index
+					sorted_index += 1
+					visit.call 2 * k + 1
+				end
 			end
+			visit.call 1
+
+			order
+		end
+
+		# The first 8 bytes padded with zeros as a big endian number, must match rodb::Key::prefix
+		def key_prefix(key)
+			(key.b + "\0" * 8)[0, 8].unpack('Q>').first
+		end
 
-			offsets
+		def dump_eytzinger_tree(keys)
+			order = eytzinger_order keys.length
+			dump_section 'eytz', [keys.length].pack('V') + order.map { |i| key_prefix keys[i] }.pack('Q<*') + order.pack('V*')
 		end
 
 		# b - boolean
@@ -34,35 +158,363 @@ module Rodb
 		# s - stirng
 		# a - array
 		# m - map
-		def dump_value(value)
-			case value
+		def scalar_binary(value)
+			inline_scalar_binary(value) || case value
 			when FalseClass
-				dump_binary 'b', [0].pack('V')
+				['b', 4, 0].pack('a4VV')
 			when TrueClass
-				dump_binary 'b', [1].pack('V')
+				['b', 4, 1].pack('a4VV')
 			when Fixnum
-				dump_binary 'i', [value].pack('V')
+				['i', 4, value].pack('a4VV')
 			when Float
-				dump_binary 'f', [value].pack('e')
+				['f', 4, value].pack('a4Ve')
 			when String
-				dump_binary 's', [value].pack('Z*')
+				['s', value.bytesize + 1, value].pack('a4VZ*')
+			when NilClass
+				raise "Unsupported type NilClass, only patches can delete keys" unless @options[:patch]
+				['d', 4, 0].pack('a4VV')
+			else
+				raise "Unsupported type #{value.class} (value: #{value})" # TODO: Trim value when too long
+			end
+		end
+
+		# Version 2 keeps small scalars in the type word: the tag in the lowest byte is upper case and
+		# the value takes the other three bytes.  Returns nil when the value doesn't fit.
+		def inline_scalar_binary(value)
+			return nil if @version < 2
+
+			case value
+			when FalseClass, TrueClass
+				[(value ? 1 : 0) << 8 | 'B'.ord].pack('V')
+			when Fixnum
+				bits = value & 0xffffffff
+				signed = bits >= 0x80000000 ? bits - 0x100000000 : bits
+				[(bits << 8 | 'I'.ord) & 0xffffffff].pack('V') if signed >= -(1 << 23) && signed < (1 << 23)
+			when Float
+				bits = [value].pack('e').unpack('V').first
+				[bits | 'F'.ord].pack('V') if bits & 0xff == 0
+			when String
+				['S', value].pack('a1a3') if value.bytesize <= INLINE_STRING_LENGTH
+			when NilClass
+				['D'.ord].pack('V') if @options[:patch]
+			end
+		end
+
+		# The arrays at the indexed paths with the fields to index them by.  A value that's met more
+		# than once gets the path of the first time, in the source order.
+		def collect_indexes(value, path, seen)
+			return unless value.is_a?(Array) || value.is_a?(Hash)
+			return if seen[value]
+			seen[value] = true
+
+			if value.is_a? Array
+				fields = @options[:indexes][path]
+				@indexes[value] = fields if fields && !fields.empty? && !packed_type(value)
+				value.each_with_index { |item, index| collect_indexes item, "#{path}[#{index}]", seen }
+			else
+				value.each { |key, item| collect_indexes item, path.empty? ? key.to_s : "#{path}.#{key}", seen }
+			end
+		end
+
+		# A hash table per field like the ones of maps, with the indices of the items that have an
+		# int or a string under the field.  The length and the name of the field padded to 4 bytes
+		# come first.  Returns all the sections.
+		def dump_indexes(items, fields)
+			fields.map do |field|
+				entries = index_entries items, field
+				slot_count = hash_slot_count entries.length
+				slots = Array.new(slot_count) { [0, EMPTY_SLOT] }
+				entries.each do |hash, index|
+					slot = hash & (slot_count - 1)
+					slot = (slot + 1) & (slot_count - 1) until slots[slot][1] == EMPTY_SLOT
+					slots[slot] = [hash, index]
+				end
+
+				name = field.b + "\0" * ((4 - field.bytesize % 4) % 4)
+				dump_section 'indx', [field.bytesize].pack('V') + name + [slot_count].pack('V') + slots.flatten.pack('V*')
+			end.join
+		end
+
+		# Must match rodb::Value::find_index, ints are hashed as 4 little endian bytes
+		def index_entries(items, field)
+			entries = []
+			items.each_with_index do |item, index|
+				value = item.is_a?(Hash) ? item[field] : nil
+				case value
+				when Fixnum
+					entries << [Rodb.hash_key([value & 0xffffffff].pack('V')), index]
+				when String
+					entries << [Rodb.hash_key(value), index]
+				end
+			end
+			entries
+		end
+
+		def indexes_size(items, fields)
+			fields.inject(0) { |sum, field| sum + 16 + (field.bytesize + 3) / 4 * 4 + 8 * hash_slot_count(index_entries(items, field).length) }
+		end
+
+		# Every profiled path with a weight and all of their prefixes, the root is always hot
+		def hot_paths(profile)
+			hot = {'' => true}
+			profile.each do |path, weight|
+				next unless weight > 0
+				hot[path] = true
+				path.length.times { |i| hot[path[0, i]] = true if '.['.include? path[i] }
+			end
+			hot
+		end
+
+		# Entries are named by the hash of everything that goes into the output: the compiler itself,
+		# the options and the content
+		def cache_key(kind, content)
+			@cache_salt ||= Marshal.dump([Digest::SHA256.file(__FILE__).digest, @version, @options.reject { |k, v| k == :cache }.sort_by { |k, v| k.to_s }])
+			Digest::SHA256.hexdigest [kind, @cache_salt, content].map { |i| [i.bytesize].pack('V') + i }.join
+		end
+
+		def cache_path(key)
+			File.join @options[:cache], key[0, 2], key[2..-1]
+		end
+
+		def cache_read(key)
+			File.binread cache_path(key)
+		rescue Errno::ENOENT
+			nil
+		end
+
+		# Renamed into place, so builds running in parallel never see a partial entry
+		def cache_write(key, data)
+			path = cache_path key
+			FileUtils.mkdir_p File.dirname(path)
+			temp = "#{path}.#{Process.pid}.#{Thread.current.object_id}"
+			File.binwrite temp, data
+			File.rename temp, path
+		end
+
+		# Subtrees don't refer outside of themselves without :dedup and :profile, so the bytes of
+		# an identical one can be copied in as they are.  A subtree is identified by its marshaled
+		# form, the small ones aren't worth the lookup and neither are their items.
+		def dump_value(value, path = nil)
+			return encode_value(value, path) unless @subtrees && (value.is_a?(Array) || value.is_a?(Hash))
+
+			content = Marshal.dump value
+			if content.length < CACHE_MIN_SIZE
+				@subtrees = false
+				encode_value value, path
+				@subtrees = true
+				return
+			end
+
+			key = cache_key 'subtree', content
+			if bytes = cache_read(key)
+				@out << bytes
+				@stats[:cached_bytes] += bytes.length
+				return
+			end
+
+			start = @out.length
+			encode_value value, path
+			cache_write key, @out[start..-1]
+		end
+
+		# Appends the value to the output.  With a profile the path of a hot value is given, its
+		# cold items are deferred until the rest is written.
+		def encode_value(value, path = nil)
+			case value
 			when Array
-				items = value.map { |i| dump_value i }
-				dump_binary 'a', [value.length].pack('V') + offsets(items).pack('V*') + items.join
+				raise "Deletions are only allowed as map values" if @options[:patch] && value.include?(nil)
+				if table_columns value
+					dump_table value
+				else
+					dump_array value, path
+				end
 			when Hash
 				if not_a_string = value.keys.find { |i| !i.is_a? String }
 					raise "Map keys should be strings (key: #{not_a_string}, value: #{value[not_a_string]})" # TODO: Trim key/value when too long
 				end
 
 				sorted_keys, sorted_values = value.empty? ? [[], []] : value.sort.transpose
-				keys = dump_value sorted_keys
-				values = dump_value sorted_values
-				dump_binary 'm', [value.length, keys.length].pack('V2') + keys + values
+				dump_keyed 'm'.ord, value.length, sorted_keys do
+					dump_array sorted_values, path, sorted_keys
+				end
 			else
-				raise "Unsupported type #{value.class} (value: #{value})" # TODO: Trim value when too long
+				@out << scalar_binary(value)
+			end
+		end
+
+		# Maps and tables: the count, the size of the keys, the keys, what the block writes and the
+		# sections
+		def dump_keyed(type, count, keys, sections = '')
+			start = @out.length
+			@out << [type, 0, count, 0].pack('V4')
+			keys_start = @out.length
+			dump_array keys
+			patch keys_start - 4, @out.length - keys_start
+			yield
+			@out << dump_hash_table(keys) if @options[:hash_maps] && !keys.empty?
+			@out << dump_eytzinger_tree(keys) if @options[:eytzinger_maps] && !keys.empty?
+			@out << sections
+			end_binary start
+		end
+
+		# With :columnar arrays of two or more maps with the same non-empty set of keys are tables.
+		# Returns the sorted keys and a column of values per key, or nil for any other array.
+		def table_columns(items)
+			return nil unless @options[:columnar] && !@options[:patch] && @version >= 2 && items.length >= 2
+
+			@tables.fetch(items) do
+				@tables[items] = begin
+					first = items[0]
+					if first.is_a?(Hash) && !first.empty? && first.keys.all? { |k| k.is_a? String }
+						keys = first.keys.sort
+						if items.all? { |i| i.is_a?(Hash) && i.length == keys.length && keys.all? { |k| i.key? k } }
+							[keys, keys.map { |k| items.map { |i| i[k] } }]
+						end
+					end
+				end
+			end
+		end
+
+		# Laid out like a map of the keys to the columns, with the number of rows in place of the
+		# number of keys.  The columns are arrays, so they're packed or tables themselves.
+		def dump_table(items)
+			keys, columns = table_columns items
+			fields = @indexes[items]
+			dump_keyed 'a'.ord | 'm'.ord << 8, items.length, keys, fields ? dump_indexes(items, fields) : '' do
+				dump_array columns
+			end
+		end
+
+		# Version 2 packs non-empty arrays of only ints, only floats or only bools.  Returns the
+		# element type or nil.
+		def packed_type(items)
+			return nil if @version < 2 || items.empty?
+
+			if items.all? { |i| i == true || i == false }
+				'b'
+			elsif items.all? { |i| i.is_a? Fixnum }
+				'i'
+			elsif items.all? { |i| i.is_a? Float }
+				'f'
 			end
 		end
 
+		# The element type goes into the second byte of the type word, 1 byte per bool, 4 per number
+		def dump_packed_array(items, type)
+			elements = case type
+				when 'b' then items.map { |i| i ? 1 : 0 }.pack('C*')
+				when 'i' then items.map { |i| i & 0xffffffff }.pack('V*')
+				when 'f' then items.pack('e*')
+			end
+
+			@out << ['a'.ord | type.ord << 8, 4 + elements.length, items.length].pack('V3') << elements
+		end
+
+		# The offsets are relative to the end of the offset table.  The keys name the items of the
+		# values array of a map in paths.  Indexed arrays end with their index sections and the size
+		# of them.
+		def dump_array(items, path = nil, keys = nil)
+			if type = packed_type(items)
+				return dump_packed_array(items, type)
+			end
+
+			fields = @indexes[items]
+			start = @out.length
+			@out << ['a'.ord | (fields ? INDEXED : 0), 0, items.length].pack('V3')
+			table = @out.length
+			@out << "\0" * (4 * items.length)
+			items.each_with_index do |item, index|
+				slot = table + 4 * index
+				base = table + 4 * items.length
+				item_path = path && (keys ? (path.empty? ? keys[index] : "#{path}.#{keys[index]}") : "#{path}[#{index}]")
+				if item_path && !@hot[item_path]
+					@deferred << [item, slot, base]
+				else
+					patch slot, dump_reference(item, item_path) - base
+				end
+			end
+			if fields
+				sections = dump_indexes items, fields
+				@out << sections << [sections.length].pack('V')
+			end
+			end_binary start
+		end
+
+		# Appends the value unless an identical one has been written already.  Returns the
+		# position of the value in the output.
+		def dump_reference(value, path = nil)
+			if @options[:dedup]
+				id = node_id value
+				if position = @positions[id]
+					@stats[:duplicates] += 1
+					@stats[:saved_bytes] += @full_sizes[id]
+					return position
+				end
+
+				@positions[id] = @out.length
+			end
+
+			position = @out.length
+			dump_value value, path
+			position
+		end
+
+		# Identical values get the same id.  Scalars are identified by their encoding, compounds
+		# by the ids of their items.  Also records the size each value takes without deduplication.
+		def node_id(value)
+			@node_ids[value] ||= begin
+				case value
+				when Array
+					if table = table_columns(value)
+						keys, columns = table
+						key_ids = keys.map { |k| node_id k }
+						column_ids = columns.map { |c| node_id c }
+						key = [:t] + key_ids + column_ids
+						size = 16 + array_size(keys, key_ids) + array_size(columns, column_ids) + sections_size(keys.length)
+					else
+						ids = value.map { |i| node_id i }
+						key = [:a] + ids
+						size = array_size value, ids
+						size += 4 if @indexes[value]
+					end
+					if fields = @indexes[value]
+						key += [:index] + fields
+						size += indexes_size(value, fields)
+					end
+				when Hash
+					sorted = value.sort
+					keys = sorted.map { |k, v| node_id k }
+					values = sorted.map { |k, v| node_id v }
+					key = [:m] + keys + values
+					size = 16 + array_size(sorted.map(&:first), keys) + array_size(sorted.map(&:last), values) + sections_size(value.length)
+				else
+					key = scalar_binary value
+					size = key.length
+				end
+
+				id = @ids[key] ||= @ids.length
+				@full_sizes[id] = size
+				id
+			end
+		end
+
+		def array_size(items, ids)
+			if type = packed_type(items)
+				12 + items.length * (type == 'b' ? 1 : 4)
+			else
+				ids.inject(12 + 4 * ids.length) { |sum, id| sum + @full_sizes[id] }
+			end
+		end
+
+		def sections_size(count)
+			return 0 if count == 0
+
+			size = 0
+			size += 12 + 8 * hash_slot_count(count) if @options[:hash_maps]
+			size += 12 + 12 * count if @options[:eytzinger_maps]
+			size
+		end
+
 		def load_yaml(yaml)
 			o = YAML::load yaml
 			if o.is_a? Array or o.is_a? Hash
@@ -73,13 +525,30 @@ module Rodb
 		end
 	end
 
-	def Rodb.compile(yaml)
-		Compiler.new.compile yaml
+	# 32-bit FNV-1a, must match rodb::Key::hash
+	def Rodb.hash_key(key)
+		key.each_byte.inject(2166136261) { |hash, byte| ((hash ^ byte) * 16777619) & 0xffffffff }
+	end
+
+	# Reads the output of rodb::Profile::dump or lines of "weight path", only the first and the last
+	# column are used.  Returns a hash of paths to weights, the root is an empty path.
+	def Rodb.load_profile(text)
+		profile = Hash.new 0
+		text.each_line do |line|
+			fields = line.split
+			next unless fields.length >= 2 && fields[0] =~ /\A\d+\z/
+			profile[fields[-1] == '(root)' ? '' : fields[-1]] += fields[0].to_i
+		end
+		profile
+	end
+
+	def Rodb.compile(yaml, options = {})
+		Compiler.new(options).compile yaml
 	end
 
-	def Rodb.compile_file(filename)
+	def Rodb.compile_file(filename, options = {})
 		File.open filename do |file|
-			compile file
+			compile file, options
 		end
 	end
 end
@@ -0,0 +1,71 @@
+#include "rodb.h"
+
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+
+void print_usage()
+{
+	std::cerr
+		<< "Usage: rodbdelta diff old.rodb new.rodb update.delta\n"
+		<< "       rodbdelta apply old.rodb update.delta new.rodb\n";
+}
+
+std::vector<char> read_file(char const *filename)
+{
+	std::ifstream in(filename, std::ios::binary);
+	if (in.fail())
+		throw std::runtime_error("Cannot open input file");
+
+	return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+void write_file(char const *filename, std::vector<char> const &data)
+{
+	std::ofstream out(filename, std::ios::binary);
+	out.write(data.empty() ? 0 : &data[0], data.size());
+	if (out.fail())
+		throw std::runtime_error("Cannot write output file");
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 5 || (strcmp(argv[1], "diff") != 0 && strcmp(argv[1], "apply") != 0))
+	{
+		print_usage();
+		return 1;
+	}
+
+	try
+	{
+		rodb::Database const old_db(argv[2]);
+		std::vector<char> output;
+		if (strcmp(argv[1], "diff") == 0)
+		{
+			rodb::Database const new_db(argv[3]);
+			rodb::Delta::make(old_db, new_db, output);
+			std::cout << "Delta size: " << output.size() << " of " << new_db.size() << " bytes\n";
+		}
+		else
+		{
+			std::vector<char> const delta = read_file(argv[3]);
+			rodb::Delta::apply(old_db, delta.empty() ? 0 : &delta[0], delta.size(), output);
+
+			// Nothing in the delta says it's for this very blob, the result has to check out
+			rodb::Database const new_db(output.empty() ? 0 : &output[0], output.size(), rodb::Database::CHECK_ALL);
+		}
+
+		write_file(argv[4], output);
+	}
+	catch (std::exception const &e)
+	{
+		std::cerr << argv[2] << ": " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
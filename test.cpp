@@ -3,6 +3,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include "rodb.h"
+#include "Compiler.h"
 
 class WhatIs
 {
@@ -42,26 +43,94 @@ private:
 #define YAML_FILENAME "unit_test.yaml"
 #define RODB_FILENAME "unit_test.rodb"
 
-char const *compile_rodb(char const *yaml)
+char const *compile_rodb(char const *yaml, char const *options = "")
 {
 	{
 		std::ofstream out(YAML_FILENAME);
 		out << yaml;
 	}
 
-	system("./yaml2rodb.rb " YAML_FILENAME " " RODB_FILENAME);
+	std::string const command = std::string("./yaml2rodb.rb ") + options + " " YAML_FILENAME " " RODB_FILENAME;
+	system(command.c_str());
 
 	return RODB_FILENAME;
 }
 
 #define DB(db, yaml) rodb::Database db(compile_rodb(yaml))
 
+std::vector<char> read_file(char const *filename)
+{
+	std::ifstream in(filename, std::ios::binary);
+	return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+char const *write_file(std::vector<char> const &blob)
+{
+	std::ofstream out(RODB_FILENAME, std::ios::binary);
+	out.write(&blob[0], blob.size());
+
+	return RODB_FILENAME;
+}
+
+std::vector<char> compile_native(char const *yaml, rodb::Compiler::Options const &options = rodb::Compiler::Options())
+{
+	rodb::Compiler compiler(options);
+	compiler.parse(yaml);
+
+	std::vector<char> blob;
+	compiler.write(blob);
+
+	return blob;
+}
+
 BOOST_AUTO_TEST_CASE(create_db)
 {
 	BOOST_CHECK(rodb::Database::load("") == 0);
 	BOOST_REQUIRE_EXCEPTION(rodb::Database(""), std::runtime_error, WhatIs("Cannot open input file"));
 }
 
+BOOST_AUTO_TEST_CASE(map_db)
+{
+	BOOST_CHECK(rodb::Database::map("") == 0);
+	BOOST_CHECK(rodb::Database::load("", rodb::Database::MAP) == 0);
+	BOOST_REQUIRE_EXCEPTION(rodb::Database("", rodb::Database::MAP), std::runtime_error, WhatIs("Cannot open input file"));
+
+	rodb::Database db(compile_rodb("{key0: [0, 1, 2], key1: string}"), rodb::Database::MAP);
+
+	BOOST_CHECK(db.mode() == rodb::Database::MAP);
+	BOOST_CHECK(db.root()["key0"][2] == 2);
+	BOOST_CHECK(db["key1"] == "string");
+}
+
+BOOST_AUTO_TEST_CASE(map_db_equals_read_db)
+{
+	char const *filename = compile_rodb("{a: [true, 1, 2.0, three], b: {c: d}}");
+	rodb::Database read_db(filename);
+	rodb::Database mapped_db(filename, rodb::Database::MAP);
+
+	BOOST_CHECK(read_db.mode() == rodb::Database::READ);
+	BOOST_CHECK(read_db.size() == mapped_db.size());
+	BOOST_CHECK(read_db.root() == mapped_db.root());
+
+	std::ostringstream read_info;
+	std::ostringstream mapped_info;
+	read_db.dump(read_info);
+	mapped_db.dump(mapped_info);
+	BOOST_CHECK(read_info.str().find(" Total size: ") != std::string::npos);
+	BOOST_CHECK(read_info.str().substr(read_info.str().find('\n')) == mapped_info.str().substr(mapped_info.str().find('\n')));
+}
+
+BOOST_AUTO_TEST_CASE(corrupted_db)
+{
+	{
+		std::ofstream out(RODB_FILENAME, std::ios::binary);
+		out << "rodb";
+	}
+
+	BOOST_REQUIRE_EXCEPTION(rodb::Database(RODB_FILENAME), std::runtime_error, WhatIs("Database integrity check failed"));
+	BOOST_REQUIRE_EXCEPTION(rodb::Database(RODB_FILENAME, rodb::Database::MAP), std::runtime_error, WhatIs("Database integrity check failed"));
+}
+
 BOOST_AUTO_TEST_CASE(scalar)
 {
 	DB(db, "[0]");
@@ -148,6 +217,705 @@ BOOST_AUTO_TEST_CASE(empty_map)
 	BOOST_REQUIRE_EXCEPTION(db.root()["key0"], std::runtime_error, WhatStartsWith("Key is not in the map"));
 }
 
+std::string big_map_yaml(size_t size)
+{
+	std::ostringstream yaml;
+	yaml << "{";
+	for (size_t i = 0; i < size; ++i)
+		yaml << (i > 0 ? ", " : "") << "key" << i << ": " << i;
+	yaml << "}";
+
+	return yaml.str();
+}
+
+BOOST_AUTO_TEST_CASE(hashed_map)
+{
+	std::string const yaml = big_map_yaml(300);
+	std::vector<char> const plain = read_file(compile_rodb(yaml.c_str()));
+	DB(db, yaml.c_str());
+	rodb::Database hashed_db(compile_rodb(yaml.c_str(), "--hash-maps"));
+
+	BOOST_CHECK(read_file(RODB_FILENAME).size() > plain.size());
+	BOOST_CHECK(hashed_db.root().size() == 300);
+	BOOST_CHECK(hashed_db.root() == db.root());
+
+	for (size_t i = 0; i < 300; ++i)
+	{
+		std::ostringstream key;
+		key << "key" << i;
+		BOOST_CHECK(hashed_db.root().has_key(key.str().c_str()));
+		BOOST_CHECK(hashed_db.root()[key.str().c_str()] == (int)i);
+	}
+
+	BOOST_CHECK(!hashed_db.root().has_key(""));
+	BOOST_CHECK(!hashed_db.root().has_key("key300"));
+	BOOST_CHECK(!hashed_db.root().has_key("key"));
+	BOOST_REQUIRE_EXCEPTION(hashed_db.root()["key300"], std::runtime_error, WhatStartsWith("Key is not in the map"));
+}
+
+BOOST_AUTO_TEST_CASE(hashed_empty_map)
+{
+	rodb::Database db(compile_rodb("{a: {}, b: {c: d}}", "--hash-maps"));
+
+	BOOST_CHECK(!db["a"].has_key(""));
+	BOOST_CHECK(db["b"]["c"] == "d");
+	BOOST_CHECK(!db["b"].has_key("d"));
+}
+
+BOOST_AUTO_TEST_CASE(eytzinger_map)
+{
+	std::string const yaml = big_map_yaml(300);
+	DB(db, yaml.c_str());
+	rodb::Database eytzinger_db(compile_rodb(yaml.c_str(), "--eytzinger-maps"));
+
+	BOOST_CHECK(eytzinger_db.root() == db.root());
+
+	for (size_t i = 0; i < 300; ++i)
+	{
+		std::ostringstream key;
+		key << "key" << i;
+		BOOST_CHECK(eytzinger_db.root()[key.str().c_str()] == (int)i);
+	}
+
+	BOOST_CHECK(!eytzinger_db.root().has_key(""));
+	BOOST_CHECK(!eytzinger_db.root().has_key("key300"));
+	BOOST_CHECK(!eytzinger_db.root().has_key("key"));
+	BOOST_CHECK(!eytzinger_db.root().has_key("zzz"));
+}
+
+BOOST_AUTO_TEST_CASE(eytzinger_map_long_keys)
+{
+	// Keys sharing the first 8 bytes have equal prefixes and need the full comparison
+	char const *yaml = "{\"\": 0, a: 1, abcdefg: 2, abcdefgh: 3, abcdefgh1: 4, abcdefgh2: 5, abcdefgi: 6, b: 7}";
+	rodb::Database db(compile_rodb(yaml, "--eytzinger-maps"));
+
+	BOOST_CHECK(db[""] == 0);
+	BOOST_CHECK(db["a"] == 1);
+	BOOST_CHECK(db["abcdefg"] == 2);
+	BOOST_CHECK(db["abcdefgh"] == 3);
+	BOOST_CHECK(db["abcdefgh1"] == 4);
+	BOOST_CHECK(db["abcdefgh2"] == 5);
+	BOOST_CHECK(db["abcdefgi"] == 6);
+	BOOST_CHECK(db["b"] == 7);
+
+	BOOST_CHECK(!db.root().has_key("abcdef"));
+	BOOST_CHECK(!db.root().has_key("abcdefgh0"));
+	BOOST_CHECK(!db.root().has_key("abcdefgh3"));
+	BOOST_CHECK(!db.root().has_key("abcdefgh12"));
+	BOOST_CHECK(!db.root().has_key("c"));
+}
+
+BOOST_AUTO_TEST_CASE(batch_lookup)
+{
+	std::string const yaml = big_map_yaml(300);
+	char const *options[] = {"", "--hash-maps", "--eytzinger-maps", "--dedup --v1"};
+
+	std::vector<std::string> names;
+	for (size_t i = 0; i < 40; ++i)
+	{
+		std::ostringstream name;
+		name << (i % 7 == 0 ? "missing" : "key") << i * 7;
+		names.push_back(name.str());
+	}
+
+	std::vector<rodb::Key> keys;
+	for (size_t i = 0; i < names.size(); ++i)
+		keys.push_back(rodb::Key(names[i].c_str()));
+
+	for (size_t o = 0; o < sizeof(options) / sizeof(options[0]); ++o)
+	{
+		BOOST_TEST_CHECKPOINT(options[o]);
+		rodb::Database db(compile_rodb(yaml.c_str(), options[o]));
+		rodb::Value const map = db.root();
+
+		std::vector<size_t> indices(keys.size());
+		map.lookup(&keys[0], keys.size(), &indices[0]);
+		for (size_t i = 0; i < keys.size(); ++i)
+		{
+			if (i % 7 == 0)
+				BOOST_CHECK(indices[i] == rodb::Value::INVALID_INDEX);
+			else
+				BOOST_CHECK(map.values()[indices[i]] == (int)i * 7);
+		}
+
+		std::vector<rodb::Value> values;
+		map.lookup(&keys[1], 6, values);
+		BOOST_REQUIRE(values.size() == 6);
+		BOOST_CHECK(values[5] == 42);
+		BOOST_REQUIRE_EXCEPTION(map.lookup(&keys[0], 2, values), std::runtime_error, WhatStartsWith("Key is not in the map"));
+
+		// An empty map has nothing to find
+		rodb::Database empty(compile_rodb("{}", options[o]));
+		size_t const invalid = rodb::Value::INVALID_INDEX;
+		empty.root().lookup(&keys[0], keys.size(), &indices[0]);
+		BOOST_CHECK(std::count(indices.begin(), indices.end(), invalid) == (long)keys.size());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(pre_hashed_keys)
+{
+	using namespace rodb::literals;
+
+	// Hashed at compile time
+	static_assert("a"_key.hash() == 0xe40c292c, "Key hash is not FNV-1a");
+	static_assert("key10"_key.length() == 5, "Key length is wrong");
+	BOOST_CHECK(rodb::Key("key10").hash() == "key10"_key.hash());
+	BOOST_CHECK(rodb::Key::lazy("key10").hash() == "key10"_key.hash());
+
+	char const *yaml = "{key0: 0, key1: 1, key10: 10, key100: 100, \"\": empty, nested: {x: 1.5}}";
+	DB(db, yaml);
+	rodb::Database hashed_db(compile_rodb(yaml, "--hash-maps"));
+
+	rodb::Value const roots[] = {db.root(), hashed_db.root()};
+	for (size_t i = 0; i < 2; ++i)
+	{
+		rodb::Value const root = roots[i];
+
+		BOOST_CHECK(root["key0"_key] == 0);
+		BOOST_CHECK(root["key1"_key] == 1);
+		BOOST_CHECK(root["key10"_key] == 10);
+		BOOST_CHECK(root["key100"_key] == 100);
+		BOOST_CHECK(root[""_key] == "empty");
+		BOOST_CHECK(root["nested"_key]["x"_key] == 1.5f);
+		BOOST_CHECK(root[rodb::Key("key10")] == root["key10"]);
+		BOOST_CHECK(root[rodb::Key::lazy("key10")] == 10);
+
+		BOOST_CHECK(root.has_key("key1"_key));
+		BOOST_CHECK(!root.has_key("key"_key));
+		BOOST_CHECK(!root.has_key("key2"_key));
+		BOOST_CHECK(!root.has_key("key1000"_key));
+		BOOST_REQUIRE_EXCEPTION(root["key2"_key], std::runtime_error, WhatStartsWith("Key is not in the map"));
+	}
+
+	BOOST_CHECK(db["key10"_key] == 10);
+}
+
+BOOST_AUTO_TEST_CASE(verified_db)
+{
+	char const *yaml = "{a: [x, {y: z}, [1, 2]], b: [x, {y: z}, [1, 2]], abcdefghij: [1, 1.5, true], c: {y: z}}";
+	rodb::Compiler::Options options;
+	options.dedup = true;
+	options.hash_maps = true;
+	options.eytzinger_maps = true;
+
+	DB(db, yaml);
+	BOOST_CHECK(!db.verified());
+	BOOST_REQUIRE_EXCEPTION(db.trusted_root(), std::runtime_error, WhatStartsWith("Database is not verified"));
+
+	db.verify();
+	BOOST_CHECK(db.verified());
+	BOOST_CHECK(db.trusted_root() == db.trusted_root());
+	BOOST_CHECK(db.trusted_root()["b"][1]["y"] == "z");
+	BOOST_CHECK(db.trusted_root()["abcdefghij"][1] == 1.5f);
+	BOOST_CHECK(db.trusted_root()["a"][2].as_span<int32_t>()[1] == 2);
+
+	rodb::Database mapped_db(write_file(compile_native(yaml, options)), rodb::Database::MAP, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(mapped_db.verified());
+	BOOST_CHECK(mapped_db.trusted_root()["c"]["y"] == "z");
+
+	options.version = 1;
+	rodb::Database v1_db(write_file(compile_native(yaml, options)), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(v1_db.trusted_root()["a"][2][1] == 2);
+}
+
+void patch(std::vector<char> &blob, char const *from, char const *to)
+{
+	std::vector<char>::iterator const i = std::search(blob.begin(), blob.end(), from, from + strlen(from));
+	BOOST_REQUIRE(i != blob.end());
+	std::copy(to, to + strlen(to), i);
+}
+
+template <typename T> void patch(std::vector<char> &blob, size_t position, T value)
+{
+	memcpy(&blob[position], &value, sizeof(value));
+}
+
+void check_verification_fails(std::vector<char> const &blob, char const *what)
+{
+	BOOST_CHECK(rodb::Database::load(write_file(blob), rodb::Database::READ, rodb::Database::CHECK_ALL) == 0);
+	BOOST_CHECK_EXCEPTION(rodb::Database(RODB_FILENAME).verify(), std::runtime_error, WhatIs(what));
+}
+
+BOOST_AUTO_TEST_CASE(corrupted_structure)
+{
+	// Root array: header at 8, count at 16, offsets from 20
+	std::vector<char> const strings = compile_native("[abc, def]");
+
+	std::vector<char> blob = strings;
+	patch(blob, 20, 0x7fffff00);
+	check_verification_fails(blob, "Database verification failed: Value is out of bounds");
+
+	blob = strings;
+	blob.back() = 'x';
+	check_verification_fails(blob, "Database verification failed: String is not terminated");
+
+	blob = strings;
+	blob[28] = 'z';
+	check_verification_fails(blob, "Database verification failed: Unknown type");
+
+	// Points the root array back at itself
+	blob = compile_native("[[abc, 1]]");
+	patch(blob, 20, -16);
+	check_verification_fails(blob, "Database verification failed: Value contains itself");
+
+	blob = compile_native("{abc: 1, abd: 2}");
+	patch(blob, "abd", "abb");
+	check_verification_fails(blob, "Database verification failed: Map keys are not sorted");
+
+	rodb::Compiler::Options options;
+	options.hash_maps = true;
+	blob = compile_native("{abc: 1, abd: 2}", options);
+	uint32_t const hash = rodb::Key("abd").hash();
+	std::vector<char>::iterator const slot = std::search(blob.begin(), blob.end(), (char const *)&hash, (char const *)&hash + 4);
+	BOOST_REQUIRE(slot != blob.end());
+	patch(blob, slot - blob.begin(), hash + 1);
+	check_verification_fails(blob, "Database verification failed: Map lookup is inconsistent");
+}
+
+BOOST_AUTO_TEST_CASE(database_handle_reload)
+{
+	rodb::DatabaseHandle handle(write_file(compile_native("{version: 1, name: first}")));
+	rodb::DatabaseHandle::Reader reader(handle);
+
+	{
+		rodb::DatabaseHandle::Snapshot snapshot(reader);
+		rodb::Value const name = snapshot.root()["name"];
+
+		write_file(compile_native("{version: 2, name: second}"));
+		BOOST_CHECK(handle.reload());
+		BOOST_CHECK(handle.generation() == 2);
+
+		// The snapshot keeps the old database alive
+		BOOST_CHECK(handle.retired() == 1);
+		BOOST_CHECK(name == "first");
+		BOOST_CHECK(snapshot.root()["version"] == 1);
+		BOOST_REQUIRE_EXCEPTION(rodb::DatabaseHandle::Snapshot another(reader), std::runtime_error, WhatStartsWith("Reader already has a snapshot"));
+	}
+
+	handle.collect();
+	BOOST_CHECK(handle.retired() == 0);
+	BOOST_CHECK(rodb::DatabaseHandle::Snapshot(reader).root()["name"] == "second");
+
+	// A failed reload keeps the current database
+	write_file(std::vector<char>(1, 'x'));
+	BOOST_CHECK(!handle.reload());
+	BOOST_CHECK(handle.generation() == 2);
+	BOOST_CHECK(rodb::DatabaseHandle::Snapshot(reader).root()["version"] == 2);
+
+	write_file(compile_native("{version: 3, name: third}"));
+	handle.reload_async();
+	while (handle.generation() != 3)
+		std::this_thread::yield();
+
+	BOOST_CHECK(rodb::DatabaseHandle::Snapshot(reader).root()["version"] == 3);
+}
+
+BOOST_AUTO_TEST_CASE(database_handle_threads)
+{
+	rodb::DatabaseHandle handle(write_file(compile_native("{a: 0, b: [0, x]}")));
+	std::atomic<bool> done(false);
+	std::atomic<int> reads(0);
+	std::atomic<int> torn_reads(0);
+
+	std::vector<std::thread> readers;
+	for (int i = 0; i < 4; ++i)
+	{
+		readers.push_back(std::thread([&]()
+		{
+			rodb::DatabaseHandle::Reader reader(handle);
+			while (!done)
+			{
+				rodb::DatabaseHandle::Snapshot snapshot(reader);
+				if ((int)snapshot.root()["a"] != (int)snapshot.root()["b"][0])
+					++torn_reads;
+				++reads;
+			}
+		}));
+	}
+
+	for (int i = 1; i <= 50; ++i)
+	{
+		std::ostringstream yaml;
+		yaml << "{a: " << i << ", b: [" << i << ", x]}";
+		write_file(compile_native(yaml.str().c_str()));
+		BOOST_CHECK(handle.reload());
+	}
+
+	done = true;
+	for (size_t i = 0; i < readers.size(); ++i)
+		readers[i].join();
+
+	handle.collect();
+	BOOST_CHECK(reads > 0);
+	BOOST_CHECK(torn_reads == 0);
+	BOOST_CHECK(handle.retired() == 0);
+	BOOST_CHECK(handle.generation() == 51);
+}
+
+BOOST_AUTO_TEST_CASE(loader)
+{
+	std::vector<char> blob = read_file(compile_rodb("{a: [1, 2, 3], b: string}"));
+	std::vector<std::string> filenames(16, RODB_FILENAME);
+	filenames[5] = "";
+
+	rodb::Loader loader(3);
+	std::vector<rodb::Loader::Future> futures = loader.load(filenames);
+	BOOST_REQUIRE(futures.size() == 16);
+	for (size_t i = 0; i < futures.size(); ++i)
+	{
+		if (i == 5)
+		{
+			BOOST_REQUIRE_EXCEPTION(futures[i].get(), std::runtime_error, WhatIs("Cannot open input file"));
+			continue;
+		}
+
+		rodb::Loader::Pointer const db = futures[i].get();
+		BOOST_CHECK(db->verified());
+		BOOST_CHECK(db->root()["a"][2] == 3);
+	}
+	BOOST_CHECK(loader.pending() == 0);
+
+	rodb::Loader::Pointer const mapped = loader.load(RODB_FILENAME, rodb::Database::MAP, rodb::Database::CHECK_HEADER).get();
+	BOOST_CHECK(mapped->mode() == rodb::Database::MAP);
+	BOOST_CHECK(!mapped->verified());
+
+	// Corrupted files fail the verification on the worker
+	blob.back() = 'x';
+	rodb::Loader::Future corrupted = loader.load(write_file(blob));
+	BOOST_REQUIRE_EXCEPTION(corrupted.get(), std::runtime_error, WhatIs("Database verification failed: String is not terminated"));
+
+	// The queued loads are finished before the loader is gone
+	std::vector<rodb::Loader::Future> queued;
+	{
+		rodb::Loader single(1);
+		queued = single.load(std::vector<std::string>(4, RODB_FILENAME), rodb::Database::READ, rodb::Database::CHECK_HEADER);
+	}
+	for (size_t i = 0; i < queued.size(); ++i)
+		BOOST_CHECK(queued[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+}
+
+class CountingAllocator: public rodb::HeapAllocator
+{
+public:
+	CountingAllocator(): allocated(0)
+	{
+	}
+
+	virtual void *allocate(size_t size)
+	{
+		allocated += size;
+		return HeapAllocator::allocate(size);
+	}
+
+	virtual void deallocate(void *memory, size_t size)
+	{
+		allocated -= size;
+		HeapAllocator::deallocate(memory, size);
+	}
+
+	size_t allocated;
+};
+
+BOOST_AUTO_TEST_CASE(caller_memory)
+{
+	std::vector<char> const blob = read_file(compile_rodb("{a: [1, 2, 3], b: string}"));
+
+	// Borrowed, the values point right into the caller's buffer
+	rodb::Database borrowed(&blob[0], blob.size(), rodb::Database::CHECK_ALL);
+	BOOST_CHECK(borrowed.borrowed());
+	BOOST_CHECK(borrowed["a"][2] == 3);
+	BOOST_CHECK((char const *)borrowed["b"] >= &blob[0] && (char const *)borrowed["b"] < &blob[0] + blob.size());
+	BOOST_REQUIRE_EXCEPTION(rodb::Database(&blob[0], 4), std::runtime_error, WhatStartsWith("Database integrity check failed"));
+
+	// Copied into an arena, the failed one gives its memory back
+	char pool[1024];
+	rodb::Arena arena(pool, sizeof(pool));
+	{
+		rodb::Database copied(&blob[0], blob.size(), arena);
+		BOOST_CHECK(!copied.borrowed());
+		BOOST_CHECK(copied.root() == borrowed.root());
+		BOOST_CHECK((char const *)copied["b"] >= pool && (char const *)copied["b"] < pool + sizeof(pool));
+		BOOST_CHECK(arena.used() >= blob.size());
+
+		std::vector<char> corrupted(blob);
+		corrupted[0] = 'x';
+		size_t const used = arena.used();
+		BOOST_REQUIRE_EXCEPTION(rodb::Database(&corrupted[0], corrupted.size(), arena), std::runtime_error, WhatStartsWith("Database integrity check failed"));
+		BOOST_CHECK(arena.used() == used);
+	}
+	BOOST_CHECK(arena.used() == 0);
+
+	rodb::Arena small(pool, 16);
+	BOOST_REQUIRE_EXCEPTION(rodb::Database(RODB_FILENAME, small), std::runtime_error, WhatStartsWith("Arena is out of memory"));
+
+	CountingAllocator allocator;
+	{
+		rodb::Database db(RODB_FILENAME, allocator);
+		BOOST_CHECK(allocator.allocated == blob.size());
+		BOOST_CHECK(db.root() == borrowed.root());
+	}
+	BOOST_CHECK(allocator.allocated == 0);
+}
+
+BOOST_AUTO_TEST_CASE(path)
+{
+	char const *yaml = "{ball: {start_position: {x: 160, y: -50}}, game: {allowed_levels: [1, 2, x, 7, 12, [100, 101, 102]]}, levels: [[1.5, 2.5], {a: b}]}";
+	DB(db, yaml);
+
+	rodb::Path const x("ball.start_position.x");
+	BOOST_CHECK(x.str() == "ball.start_position.x");
+	BOOST_CHECK(x(db) == 160);
+	BOOST_CHECK(x(db) == 160);
+	BOOST_CHECK(rodb::Path("game.allowed_levels[5][1]")(db) == 101);
+	BOOST_CHECK(rodb::Path("levels[0][1]")(db) == 2.5f);
+	BOOST_CHECK(rodb::Path("levels[1].a")(db) == "b");
+	BOOST_CHECK(rodb::Path("")(db) == db.root());
+
+	char const *invalid[] = {".a", "a.", "a..b", "a[", "a[]", "a[-1]", "a[x]", "a[0]b", "[0"};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i)
+		BOOST_CHECK_EXCEPTION(rodb::Path p(invalid[i]), std::runtime_error, WhatStartsWith("Path is invalid"));
+
+	rodb::Path const missing("ball.start_position.z");
+	BOOST_REQUIRE_EXCEPTION(missing(db), std::runtime_error, WhatStartsWith("Key is not in the map"));
+	BOOST_REQUIRE_EXCEPTION(rodb::Path("game.allowed_levels[6]")(db), std::runtime_error, WhatStartsWith("Index is out of bounds"));
+
+	// Resolved again for another database, even one created in place of the previous one
+	std::vector<char> blob = read_file(compile_rodb("{ball: {start_position: {x: 1}}}"));
+	rodb::Database other(&blob[0], blob.size());
+	BOOST_CHECK(x(other) == 1);
+	BOOST_CHECK(x(db) == 160);
+
+	alignas(rodb::Database) char storage[sizeof(rodb::Database)];
+	rodb::Database *reused = new (storage) rodb::Database(&blob[0], blob.size());
+	BOOST_CHECK(x(*reused) == 1);
+	reused->~Database();
+
+	blob = read_file(compile_rodb("{ball: {start_position: {x: 2}}}"));
+	reused = new (storage) rodb::Database(&blob[0], blob.size());
+	BOOST_CHECK(x(*reused) == 2);
+	reused->~Database();
+}
+
+BOOST_AUTO_TEST_CASE(overlay)
+{
+	DB(base, "{a: 1, b: {x: 1, y: 2, z: [1, 2]}, c: {p: 1}, d: [1, 2], e: 5}");
+	rodb::Database patch(compile_rodb("{b: {y: 20, z: [3], w: 4, x: ~}, c: 7, e: ~, f: {q: 1}}", "--patch"));
+	rodb::Database top(compile_rodb("{b: {y: 30}, g: ~}", "--patch"));
+
+	rodb::Overlay overlay;
+	BOOST_REQUIRE_EXCEPTION(overlay.root(), std::runtime_error, WhatStartsWith("Overlay has no layers"));
+
+	overlay.push(base);
+	BOOST_CHECK(overlay.root().value() == base.root());
+
+	overlay.push(patch);
+	overlay.push(top);
+	BOOST_CHECK(overlay.layer_count() == 3);
+
+	BOOST_CHECK(overlay["a"] == 1);
+	BOOST_CHECK(overlay["b"]["y"] == 30);
+	BOOST_CHECK(overlay["b"]["w"] == 4);
+	BOOST_CHECK(overlay["b"]["z"].size() == 1);
+	BOOST_CHECK(overlay["b"]["z"][0] == 3);
+	BOOST_CHECK(overlay["c"] == 7);
+	BOOST_CHECK(overlay["d"][1] == 2);
+	BOOST_CHECK(overlay["f"]["q"] == 1);
+
+	// Deleted keys are gone, keys deleted without anything below too
+	BOOST_CHECK(!overlay["b"].has_key("x"));
+	BOOST_CHECK(!overlay.root().has_key("e"));
+	BOOST_CHECK(!overlay.root().has_key("g"));
+	BOOST_REQUIRE_EXCEPTION(overlay["e"], std::runtime_error, WhatStartsWith("Key is not in the map"));
+	BOOST_REQUIRE_EXCEPTION(overlay["b"]["x"], std::runtime_error, WhatStartsWith("Key is not in the map"));
+	BOOST_REQUIRE_EXCEPTION(overlay["c"]["p"], std::runtime_error, WhatStartsWith("Value is not a map"));
+
+	std::vector<char const *> const keys = overlay.root().keys();
+	BOOST_REQUIRE(keys.size() == 5);
+	BOOST_CHECK(keys[0] == std::string("a") && keys[1] == std::string("b") && keys[2] == std::string("c"));
+	BOOST_CHECK(keys[3] == std::string("d") && keys[4] == std::string("f"));
+	BOOST_CHECK(overlay["b"].size() == 3);
+
+	// The deletions are values of their own in the patch
+	BOOST_CHECK(patch["e"].is_deleted());
+	BOOST_CHECK(patch["b"]["x"] == patch["e"]);
+	patch.verify();
+}
+
+BOOST_AUTO_TEST_CASE(delta)
+{
+	std::string yaml = "{a: [";
+	for (int i = 0; i < 200; ++i)
+		yaml += "item" + std::to_string(i) + ", ";
+	yaml += "last], b: {c: 1, d: [1.5, 2.5]}, e: string}";
+
+	std::string const same_size = std::string(yaml).replace(yaml.find("c: 1"), 4, "c: 7");
+	std::string const longer = std::string(yaml).replace(yaml.find("item10,"), 7, "item10x, extra,");
+
+	std::vector<char> const from = compile_native(yaml.c_str());
+	rodb::Database const from_db(&from[0], from.size());
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		std::vector<char> const to = compile_native((pass == 0 ? same_size : longer).c_str());
+		rodb::Database const to_db(&to[0], to.size());
+
+		std::vector<char> delta;
+		rodb::Delta::make(from_db, to_db, delta);
+		BOOST_CHECK(delta.size() < to.size() / 4);
+		BOOST_CHECK(rodb::Delta::target_size(&delta[0], delta.size()) == to.size());
+
+		std::vector<char> blob;
+		rodb::Delta::apply(from_db, &delta[0], delta.size(), blob);
+		BOOST_CHECK(blob == to);
+
+		// In place the buffer needs room for the longer blob
+		std::vector<char> buffer(from);
+		buffer.resize(std::max(from.size(), to.size()));
+		BOOST_REQUIRE(rodb::Delta::apply_in_place(&buffer[0], from.size(), buffer.size(), &delta[0], delta.size()));
+		buffer.resize(to.size());
+		BOOST_CHECK(buffer == to);
+	}
+
+	// Any blobs work, even ones that have nothing in common
+	std::vector<char> const other = compile_native("[1, 2, 3]");
+	std::vector<char> delta;
+	rodb::Delta::make(&other[0], other.size(), &from[0], from.size(), delta);
+	std::vector<char> blob(from.size());
+	rodb::Delta::apply(&other[0], other.size(), &delta[0], delta.size(), &blob[0]);
+	BOOST_CHECK(blob == from);
+
+	// Swapped halves can't be moved in place, either one overwrites the other
+	std::string const halves = std::string(64, 'a') + std::string(64, 'b');
+	std::string const swapped = halves.substr(64) + halves.substr(0, 64);
+	rodb::Delta::make(halves.data(), halves.size(), swapped.data(), swapped.size(), delta);
+	BOOST_CHECK(delta.size() < halves.size());
+	std::string buffer = halves;
+	BOOST_CHECK(!rodb::Delta::apply_in_place(&buffer[0], buffer.size(), buffer.size(), &delta[0], delta.size()));
+	BOOST_CHECK(buffer == halves);
+
+	rodb::Delta::make(&other[0], other.size(), &from[0], from.size(), delta);
+	BOOST_REQUIRE_EXCEPTION(rodb::Delta::apply(from_db, &delta[0], delta.size(), blob), std::runtime_error, WhatStartsWith("Delta is made for a different blob"));
+	BOOST_REQUIRE_EXCEPTION(rodb::Delta::apply(&other[0], other.size(), &delta[0], delta.size() - 1, &blob[0]), std::runtime_error, WhatStartsWith("Delta is corrupted"));
+	delta[0] = 'x';
+	BOOST_REQUIRE_EXCEPTION(rodb::Delta::target_size(&delta[0], delta.size()), std::runtime_error, WhatStartsWith("Delta is corrupted"));
+}
+
+BOOST_AUTO_TEST_CASE(paged_db)
+{
+	std::string const yaml = "{small: {a: 1, b: [x, -1, 2.5, 1.5, yes]}, ints: [1, 2, 100000000], bools: [true, false], long: a string that doesn't fit in a tiny page, big: " + big_map_yaml(200) + "}";
+	DB(db, yaml.c_str());
+
+	BOOST_REQUIRE_EXCEPTION(rodb::PagedDatabase(RODB_FILENAME, 10, 64), std::runtime_error, WhatStartsWith("Memory budget is smaller than a page"));
+	BOOST_REQUIRE_EXCEPTION(rodb::PagedDatabase(""), std::runtime_error, WhatIs("Cannot open input file"));
+
+	// Four 64 byte pages for a blob of a few kilobytes
+	rodb::PagedDatabase paged(RODB_FILENAME, 256, 64);
+	BOOST_CHECK(paged.size() == db.size());
+	BOOST_CHECK(paged.page_count() == 4);
+	BOOST_CHECK(paged.root().is_map());
+	BOOST_CHECK(paged.root().size() == db.root().size());
+
+	BOOST_CHECK(paged["small"]["a"] == 1);
+	BOOST_CHECK(std::string(paged["small"]["b"][0]) == "x");
+	BOOST_CHECK(paged["small"]["b"][1] == -1);
+	BOOST_CHECK(paged["small"]["b"][2] == 2.5f);
+	BOOST_CHECK(paged["small"]["b"][3] == 1.5f);
+	BOOST_CHECK(paged["small"]["b"][4] == true);
+	BOOST_CHECK(paged["ints"].is_packed());
+	BOOST_CHECK(paged["ints"][2] == 100000000);
+	BOOST_CHECK(paged["bools"][0] == true && paged["bools"][1] == false);
+	BOOST_CHECK(std::string(paged["long"]) == (char const *)db["long"]);
+	BOOST_CHECK(!paged["small"].has_key("c"));
+	BOOST_REQUIRE_EXCEPTION(paged["small"]["c"], std::runtime_error, WhatStartsWith("Key is not in the map"));
+	BOOST_REQUIRE_EXCEPTION(paged["ints"][3], std::runtime_error, WhatStartsWith("Index is out of bounds"));
+
+	rodb::Value const big = db["big"];
+	for (size_t i = 0; i < big.size(); ++i)
+	{
+		char const *key = big.keys()[i];
+		BOOST_CHECK(std::string(paged["big"].keys()[i]) == key);
+		BOOST_CHECK(paged["big"][key] == (int)big[key]);
+	}
+
+	BOOST_CHECK(paged.resident_pages() <= paged.page_count());
+	BOOST_CHECK(paged.statistics().hits > 0);
+	BOOST_CHECK(paged.statistics().evictions > 0);
+	BOOST_CHECK(paged.statistics().misses == paged.statistics().evictions + paged.resident_pages());
+
+	// Only the pages on the way to the value are read
+	rodb::PagedDatabase cold(RODB_FILENAME);
+	BOOST_CHECK(cold["small"]["a"] == 1);
+	BOOST_CHECK(cold.statistics().misses == 1);
+	BOOST_CHECK(cold.statistics().bytes_read == cold.size());
+
+	rodb::PagedDatabase fresh(RODB_FILENAME, 1024, 64);
+	BOOST_CHECK(fresh["small"]["a"] == 1);
+	BOOST_CHECK(fresh.statistics().bytes_read < fresh.size() / 4);
+}
+
+// Walks both all the way down
+void check_paged(rodb::Value const &value, rodb::PagedValue const &paged)
+{
+	BOOST_REQUIRE(paged.type() == value.type());
+	switch (value.type())
+	{
+	case rodb::Value::BOOL:
+		BOOST_CHECK((bool)paged == (bool)value);
+		break;
+	case rodb::Value::INT:
+		BOOST_CHECK((int)paged == (int)value);
+		break;
+	case rodb::Value::FLOAT:
+		BOOST_CHECK((float)paged == (float)value);
+		break;
+	case rodb::Value::STRING:
+		BOOST_CHECK(std::string(paged) == (char const *)value);
+		break;
+	case rodb::Value::DELETED:
+		break;
+	case rodb::Value::ARRAY:
+		BOOST_REQUIRE(paged.size() == value.size());
+		BOOST_CHECK(paged.is_packed() == value.is_packed());
+		BOOST_CHECK(paged.is_table() == value.is_table());
+		for (size_t i = 0; i < value.size(); ++i)
+			check_paged(value[i], paged[i]);
+		break;
+	case rodb::Value::MAP:
+		BOOST_REQUIRE(paged.size() == value.size());
+		for (size_t i = 0; i < value.size(); ++i)
+		{
+			char const *key = value.keys()[i];
+			check_paged(value.keys()[i], paged.keys()[i]);
+			check_paged(value.values()[i], paged.values()[i]);
+			check_paged(value[key], paged[key]);
+		}
+		break;
+	}
+}
+
+BOOST_AUTO_TEST_CASE(paged_db_matches_value)
+{
+	char const *yaml =
+		"{bools: [true, false, yes], ints: [0, -1, 8388607, -8388608, 8388608, 2147483647, -2147483648], "
+		"floats: [0.0, 1.5, -2.25, 3.14159, 1.0e30], strings: ['', a, abc, abcd, a much longer string], "
+		"mixed: [1, 2.5, x, true, [], {}, [[1], {a: b}]], "
+		"table: [{id: 1, name: elf, x: 1.5}, {id: 2, name: orc, x: 2.5}, {id: 3, name: imp, x: -1.0}], "
+		"map: {'': empty, k: 1, key: 2, keys: 3, a key that spans a page or two of the cache: 4}}";
+	char const *options[] = {"", "--v1", "--hash-maps", "--eytzinger-maps", "--dedup", "--columnar", "--index table:id --index table:name", "--columnar --hash-maps --index table:id"};
+	for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); ++i)
+	{
+		BOOST_TEST_CHECKPOINT(options[i]);
+		rodb::Database db(compile_rodb(yaml, options[i]));
+		rodb::PagedDatabase paged(RODB_FILENAME, 256, 64);
+		check_paged(db.root(), paged.root());
+		BOOST_CHECK(paged.resident_pages() <= paged.page_count());
+	}
+
+	rodb::Database patch(compile_rodb("{a: ~, b: {c: ~, d: 1}}", "--patch"));
+	rodb::PagedDatabase paged_patch(RODB_FILENAME, 256, 64);
+	check_paged(patch.root(), paged_patch.root());
+}
+
 BOOST_AUTO_TEST_CASE(map_sorted)
 {
 	DB(db, "{key4: 4, key0: 0, key2: 2, key1: 1, key3: 3}");
@@ -231,6 +999,316 @@ BOOST_AUTO_TEST_CASE(strings)
 	BOOST_CHECK("string3" == db.root()[3]);
 }
 
+BOOST_AUTO_TEST_CASE(inline_scalars)
+{
+	char const *yaml = "[false, true, 0, -1, 8388607, -8388608, 8388608, -8388609, 1.5, 0.1, '', a, ab, abc, {ab: 1, abcdef: 2.5}]";
+	std::vector<char> const v1 = read_file(compile_rodb(yaml, "--v1"));
+	DB(db, yaml);
+
+	BOOST_CHECK(read_file(RODB_FILENAME).size() < v1.size());
+	BOOST_CHECK(!db[0]);
+	BOOST_CHECK(db[1]);
+	BOOST_CHECK(db[2] == 0);
+	BOOST_CHECK(db[3] == -1);
+	BOOST_CHECK(db[4] == 8388607);
+	BOOST_CHECK(db[5] == -8388608);
+	BOOST_CHECK(db[6] == 8388608);
+	BOOST_CHECK(db[7] == -8388609);
+	BOOST_CHECK(db[8] == 1.5f);
+	BOOST_CHECK(db[9] == 0.1f);
+	BOOST_CHECK(db[10] == "");
+	BOOST_CHECK(db[11] == "a");
+	BOOST_CHECK(db[12] == "ab");
+	BOOST_CHECK(db[13] == "abc");
+	BOOST_CHECK(db[14]["ab"] == 1);
+	BOOST_CHECK(db[14]["abcdef"] == 2.5f);
+	BOOST_CHECK(!db[14].has_key("a"));
+}
+
+BOOST_AUTO_TEST_CASE(packed_arrays)
+{
+	char const *yaml = "{i: [100, 101, -102], f: [0.5, 1.5], b: [true, false, true], mixed: [1, 1.5], s: [a, b], e: [], m: {x: 1, y: 2}}";
+	std::vector<char> const v1 = read_file(compile_rodb(yaml, "--v1"));
+	DB(db, yaml);
+	rodb::Database v1_db(compile_rodb(yaml, "--v1"));
+
+	BOOST_CHECK(db.size() < v1.size());
+	BOOST_CHECK(db.root() == v1_db.root());
+
+	BOOST_CHECK(db["i"].is_packed());
+	BOOST_CHECK(db["f"].is_packed());
+	BOOST_CHECK(db["b"].is_packed());
+	BOOST_CHECK(!db["mixed"].is_packed());
+	BOOST_CHECK(!db["s"].is_packed());
+	BOOST_CHECK(!db["e"].is_packed());
+	BOOST_CHECK(!db["m"].is_packed());
+	BOOST_CHECK(db["m"].values().is_packed());
+	BOOST_CHECK(!v1_db["i"].is_packed());
+
+	rodb::Span<int32_t> const ints = db["i"].as_span<int32_t>();
+	BOOST_REQUIRE(ints.size() == 3);
+	BOOST_CHECK(ints[0] == 100 && ints[1] == 101 && ints[2] == -102);
+	BOOST_CHECK(ints.end() - ints.begin() == 3);
+
+	rodb::Span<float> const floats = db["f"].as_span<float>();
+	BOOST_REQUIRE(floats.size() == 2);
+	BOOST_CHECK(floats[0] == 0.5f && floats[1] == 1.5f);
+
+	rodb::Span<bool> const bools = db["b"].as_span<bool>();
+	BOOST_REQUIRE(bools.size() == 3);
+	BOOST_CHECK(bools[0] && !bools[1] && bools[2]);
+
+	// Element access works the same
+	BOOST_CHECK(db["i"][2].is_int());
+	BOOST_CHECK(db["i"][2] == -102);
+	BOOST_CHECK(db["f"][1] == 1.5f);
+	BOOST_CHECK(!db["b"][1]);
+	BOOST_CHECK(db["m"]["y"] == 2);
+
+	BOOST_REQUIRE_EXCEPTION(db["i"].as_span<float>(), std::runtime_error, WhatStartsWith("Packed array has a different type"));
+	BOOST_REQUIRE_EXCEPTION(db["s"].as_span<int32_t>(), std::runtime_error, WhatStartsWith("Value is not a packed array"));
+	BOOST_REQUIRE_EXCEPTION(v1_db["i"].as_span<int32_t>(), std::runtime_error, WhatStartsWith("Value is not a packed array"));
+	BOOST_REQUIRE_EXCEPTION((float)db["i"][0], std::runtime_error, WhatStartsWith("Value is not convertible to float"));
+}
+
+BOOST_AUTO_TEST_CASE(columnar_tables)
+{
+	char const *yaml =
+		"spawns: [{x: 1.5, y: 2.5, name: orc, tags: [a]}, {name: elf, x: 3.5, y: 4.5, tags: [b, c]}, {x: 5.5, y: 6.5, name: imp, tags: []}]\n"
+		"grid: [[{id: 1, at: {r: 0, c: 0}}, {id: 2, at: {r: 0, c: 1}}], [{id: 3, at: {r: 1, c: 0}}, {id: 4, at: {r: 1, c: 1}}]]\n"
+		"mixed: [{x: 1}, {y: 2}]\n"
+		"single: [{x: 1}]\n";
+
+	rodb::Database db(compile_rodb(yaml, "--columnar"), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	DB(plain, yaml);
+	BOOST_CHECK(db.root() == plain.root());
+
+	rodb::Value const spawns = db["spawns"];
+	BOOST_CHECK(spawns.is_table());
+	BOOST_CHECK(!spawns.is_packed());
+	BOOST_CHECK(!db["mixed"].is_table());
+	BOOST_CHECK(!db["single"].is_table());
+	BOOST_CHECK(!plain["spawns"].is_table());
+
+	// Rows are maps
+	BOOST_REQUIRE(spawns.size() == 3);
+	BOOST_CHECK(spawns[1].is_map());
+	BOOST_CHECK(spawns[1].size() == 4);
+	BOOST_CHECK(spawns[1]["name"] == "elf");
+	BOOST_CHECK(spawns[2]["y"] == 6.5f);
+	BOOST_CHECK(spawns[1]["tags"][1] == "c");
+	BOOST_CHECK(spawns[0].has_key("x") && !spawns[0].has_key("z"));
+	BOOST_CHECK(spawns[1].keys()[0] == "name");
+	BOOST_CHECK(spawns[1].values()[0] == "elf");
+	BOOST_CHECK(spawns[1] == plain["spawns"][1]);
+	BOOST_REQUIRE_EXCEPTION(spawns[0]["z"], std::runtime_error, WhatStartsWith("Key is not in the map"));
+	BOOST_REQUIRE_EXCEPTION(spawns[3], std::runtime_error, WhatStartsWith("Index is out of bounds"));
+
+	// Nested tables and maps in columns
+	BOOST_CHECK(db["grid"][1].is_table());
+	BOOST_CHECK(db["grid"][1][0]["id"] == 3);
+	BOOST_CHECK(db["grid"][1][1]["at"]["c"] == 1);
+	BOOST_CHECK(db["grid"][0].column("at").is_table());
+
+	// Columns
+	rodb::Span<float> const x = spawns.column("x").as_span<float>();
+	BOOST_REQUIRE(x.size() == 3);
+	BOOST_CHECK(x[0] == 1.5f && x[1] == 3.5f && x[2] == 5.5f);
+	BOOST_CHECK(spawns.column("name")[2] == "imp");
+	BOOST_REQUIRE_EXCEPTION(spawns.column("z"), std::runtime_error, WhatStartsWith("Key is not in the table"));
+	BOOST_REQUIRE_EXCEPTION(db["mixed"].column("x"), std::runtime_error, WhatStartsWith("Value is not a table"));
+
+	// Iterators make the rows too
+	std::string names;
+	for (rodb::Value const &spawn: spawns)
+		names += (char const *)spawn["name"];
+	BOOST_CHECK(names == "orcelfimp");
+	BOOST_CHECK(spawns.end() - spawns.begin() == 3);
+
+	std::string keys;
+	for (auto const &item: spawns[2].items())
+		keys += (char const *)item.first;
+	BOOST_CHECK(keys == "nametagsxy");
+	BOOST_CHECK(std::distance(spawns[2].values().begin(), spawns[2].values().end()) == 4);
+	BOOST_CHECK(spawns[2].values().begin()[3] == 6.5f);
+
+	static rodb::Path const tag("spawns[1].tags[0]");
+	BOOST_CHECK(tag(db) == "b");
+
+	rodb::PagedDatabase paged(compile_rodb(yaml, "--columnar"), 1024, 64);
+	BOOST_CHECK(paged["spawns"].is_table());
+	BOOST_CHECK(std::string(paged["spawns"][1]["name"]) == "elf");
+	BOOST_CHECK(paged["spawns"][2].size() == 4);
+	BOOST_CHECK(paged["spawns"][0]["x"] == 1.5f);
+	BOOST_CHECK(paged["spawns"].column("y")[1] == 4.5f);
+	BOOST_CHECK(paged["grid"][0][1]["at"]["c"] == 1);
+
+	// Hash maps work for the rows, and the verifier checks the columns
+	rodb::Database hashed(compile_rodb(yaml, "--columnar --hash-maps"), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(hashed["spawns"][2]["name"] == "imp");
+	std::vector<char> blob = read_file(compile_rodb("[{a: 1, b: 2}, {a: 3, b: 4}]", "--columnar"));
+	// Table at 8, keys at 24, columns at 52, the count of the first column at 80
+	patch<uint32_t>(blob, 80, 3);
+	check_verification_fails(blob, "Database verification failed: Table column is corrupted");
+}
+
+BOOST_AUTO_TEST_CASE(indexes)
+{
+	char const *yaml =
+		"items: [{id: 10, name: sword}, {id: 20, name: shield}, {name: bow}, {id: 20, name: helmet}, {id: -5, name: [x]}, 7]\n"
+		"spawns: [{id: 1, at: a}, {id: 2, at: b}]\n"
+		"other: [{id: 1}]\n";
+	char const *options = "--index items:id --index items:name --index spawns:at";
+
+	rodb::Database db(compile_rodb(yaml, options), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	DB(plain, yaml);
+	BOOST_CHECK(db.root() == plain.root());
+
+	rodb::Value const items = db["items"];
+	BOOST_CHECK(items.size() == 6);
+	BOOST_CHECK(items.find_by("id", 10)["name"] == "sword");
+	BOOST_CHECK(items.find_by("id", -5)["name"][0] == "x");
+	BOOST_CHECK(items.find_by("name", "bow") == items[2]);
+
+	// Duplicates find the first one, elements without the field or of other types are skipped
+	BOOST_CHECK(items.find_index("id", 20) == 1);
+	BOOST_CHECK(items.find_index("id", 30) == rodb::Value::INVALID_INDEX);
+	BOOST_CHECK(items.find_index("name", "x") == rodb::Value::INVALID_INDEX);
+	BOOST_CHECK(items.find_index("missing", 10) == rodb::Value::INVALID_INDEX);
+
+	// Without an index the elements are searched in order
+	BOOST_CHECK(plain["items"].find_index("id", 20) == 1);
+	BOOST_CHECK(plain["items"].find_by("name", "helmet")["id"] == 20);
+	BOOST_CHECK(db["other"].find_by("id", 1) == db["other"][0]);
+	BOOST_REQUIRE_EXCEPTION(items.find_by("id", 30), std::runtime_error, WhatStartsWith("Value is not in the array"));
+	BOOST_REQUIRE_EXCEPTION(db["spawns"][0].find_by("id", 1), std::runtime_error, WhatStartsWith("Value is not an array"));
+
+	// Tables keep their indexes with the other sections
+	rodb::Database table(compile_rodb(yaml, "--columnar --hash-maps --index items:id --index spawns:at"), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(table["spawns"].is_table());
+	BOOST_CHECK(table["spawns"].find_by("at", "b")["id"] == 2);
+	BOOST_CHECK(table["spawns"].find_index("id", 2) == 1);
+	BOOST_CHECK(table["items"].find_by("id", 20)["name"] == "shield");
+
+	// The verifier checks the rows in the index
+	std::vector<char> blob = read_file(compile_rodb("[{a: 1}, {a: 2}]", "--index :a"));
+	BOOST_CHECK(rodb::Database(write_file(blob)).root().find_by("a", 2)["a"] == 2);
+	// The field name is padded to 4 bytes, the 4 slots follow the slot count
+	size_t const slots = std::search(blob.begin(), blob.end(), "indx", "indx" + 4) - blob.begin() + 20;
+	BOOST_REQUIRE(*reinterpret_cast<uint32_t const *>(&blob[slots - 4]) == 4);
+	for (size_t slot = slots; slot < slots + 4 * 8; slot += 8)
+		if (*reinterpret_cast<uint32_t const *>(&blob[slot + 4]) == 1)
+			patch<uint32_t>(blob, slot + 4, 2);
+	check_verification_fails(blob, "Database verification failed: Array index is corrupted");
+}
+
+BOOST_AUTO_TEST_CASE(version_1_db)
+{
+	char const *yaml = "{a: [true, 1, 2.0, three], b: {c: d}}";
+	DB(db, yaml);
+	rodb::Database v1_db(compile_rodb(yaml, "--v1"));
+
+	std::ostringstream info;
+	v1_db.dump(info);
+	BOOST_CHECK(info.str().find("    Version: 1\n") != std::string::npos);
+	BOOST_CHECK(v1_db.root() == db.root());
+
+	// Newer versions are rejected
+	std::vector<char> blob = read_file(RODB_FILENAME);
+	blob[4] = 3;
+	BOOST_REQUIRE_EXCEPTION(rodb::Database(write_file(blob)), std::runtime_error, WhatIs("Database integrity check failed"));
+}
+
+BOOST_AUTO_TEST_CASE(iterators)
+{
+	DB(db, "{mixed: [x, 1, [2], {y: z}], packed: [1.5, 2.5, 3.5], empty: [], map: {c: 3, a: 1, b: 2}}");
+
+	rodb::Value const mixed = db["mixed"];
+	size_t i = 0;
+	for (rodb::Value const &value: mixed)
+		BOOST_CHECK(value == mixed[i++]);
+	BOOST_CHECK(i == 4);
+	BOOST_CHECK(std::distance(mixed.begin(), mixed.end()) == 4);
+	BOOST_CHECK(mixed.begin()[3]["y"] == "z");
+	BOOST_CHECK(*(mixed.end() - 2) == mixed[2]);
+	BOOST_CHECK(2 + mixed.begin() > mixed.begin());
+
+	float sum = 0;
+	for (rodb::Value const &value: db["packed"])
+		sum += (float)value;
+	BOOST_CHECK(sum == 7.5f);
+	BOOST_CHECK(db["packed"].end() - db["packed"].begin() == 3);
+	BOOST_CHECK(db["empty"].begin() == db["empty"].end());
+
+	std::string keys;
+	int values = 0;
+	for (auto const &item: db["map"].items())
+	{
+		keys += (char const *)item.first;
+		values = values * 10 + (int)item.second;
+	}
+	BOOST_CHECK(keys == "abc");
+	BOOST_CHECK(values == 123);
+
+	// Keys are sorted, so the items can be searched
+	rodb::Value::MapItems const items = db["map"].items();
+	rodb::Value::MapIterator const b = std::lower_bound(items.begin(), items.end(), "b", [](std::pair<rodb::Value, rodb::Value> const &item, char const *key) {
+		return strcmp(item.first, key) < 0;
+	});
+	BOOST_CHECK(b - items.begin() == 1);
+	BOOST_CHECK((*b).second == 2);
+	BOOST_CHECK(std::count_if(db.root().items().begin(), db.root().items().end(), [](std::pair<rodb::Value, rodb::Value> const &item) { return item.second.is_array(); }) == 3);
+
+	BOOST_REQUIRE_EXCEPTION(db["map"].begin(), std::runtime_error, WhatStartsWith("Value is not an array"));
+	BOOST_REQUIRE_EXCEPTION(mixed.items(), std::runtime_error, WhatStartsWith("Value is not a map"));
+}
+
+BOOST_AUTO_TEST_CASE(profile)
+{
+	DB(db, "{a: {x: 1, y: 2}, b: [10, 20]}");
+	rodb::Profile::reset();
+
+	BOOST_CHECK(db["a"]["x"] == 1);
+	BOOST_CHECK(!db["a"].has_key("z"));
+	BOOST_CHECK(db["b"][1] == 20);
+
+	std::thread thread([&db]() {
+		for (int i = 0; i < 3; ++i)
+			BOOST_CHECK(db["a"]["y"] == 2);
+	});
+	thread.join();
+
+	std::vector<rodb::Profile::Entry> const entries = rodb::Profile::hot_paths(db.root());
+	std::ostringstream stream;
+	rodb::Profile::dump(db.root(), stream);
+
+#ifdef CONFIG_PROFILE
+	char const *paths[] = {"", "a", "a.y", "a.x", "b", "b[1]"};
+	uint64_t accesses[] = {6, 5, 3, 1, 1, 1};
+	BOOST_REQUIRE(entries.size() == 6);
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		BOOST_CHECK(entries[i].path == paths[i]);
+		BOOST_CHECK(entries[i].counters.accesses == accesses[i]);
+	}
+
+	BOOST_CHECK(entries[0].offset == 0);
+	BOOST_CHECK(entries[0].counters.probes >= 6);
+	BOOST_CHECK(entries[1].counters.misses == 1);
+	BOOST_CHECK(entries[2].counters.misses == 0);
+	BOOST_CHECK(stream.str().find("         0         0  (root)\n") != std::string::npos);
+	BOOST_CHECK(stream.str().find("  b[1]\n") != std::string::npos);
+
+	// The walk itself isn't counted
+	BOOST_CHECK(rodb::Profile::hot_paths(db.root())[0].counters.accesses == 6);
+
+	rodb::Profile::reset();
+	BOOST_CHECK(rodb::Profile::hot_paths(db.root()).empty());
+#else
+	BOOST_CHECK(entries.empty());
+#endif
+}
+
 BOOST_AUTO_TEST_CASE(nested_arrays)
 {
 	DB(db, "[[0], [1, 2], [3, 4, 5], [[0]], [[[0]]]]");
@@ -267,6 +1345,49 @@ BOOST_AUTO_TEST_CASE(dump_yaml)
 	DB(db2, stream.str().c_str());
 	BOOST_CHECK(db2.root().size() == 5);
 	BOOST_CHECK(db2.root()[4][0][0][0] == 0);
+
+	// Everything reads back the same, floats stay floats
+	char const *yaml = "{a: [0.1, 1.0, -2.5e-20, 3.0e+30, 16777216.0], b: \"q\\\"b\\\\s\\tt\", c: [], d: {}, e: [true, -2147483648, {f: [x]}], g: [1, 2]}";
+	DB(db3, yaml);
+	stream.str("");
+	db3.dump_yaml(stream);
+	DB(db4, stream.str().c_str());
+	BOOST_CHECK(db4.root() == db3.root());
+	BOOST_CHECK(rodb::Database(write_file(compile_native(stream.str().c_str()))).root() == db3.root());
+	BOOST_CHECK(db4["a"][1].is_float() && db4["a"][3] == 3.0e+30f);
+	BOOST_CHECK(db4["b"] == "q\"b\\s\tt");
+
+	rodb::Database table(compile_rodb("{t: [{x: 1, y: [a]}, {x: 2, y: []}]}", "--columnar"));
+	stream.str("");
+	table.dump_json(stream);
+	BOOST_CHECK(stream.str() ==
+		"{\n"
+		"    \"t\": [\n"
+		"        {\n"
+		"            \"x\": 1,\n"
+		"            \"y\": [\n"
+		"                \"a\"\n"
+		"            ]\n"
+		"        },\n"
+		"        {\n"
+		"            \"x\": 2,\n"
+		"            \"y\": []\n"
+		"        }\n"
+		"    ]\n"
+		"}\n");
+
+	// A small buffer is flushed as it fills up, patches have nulls
+	rodb::Database patch(compile_rodb("{a: ~, b: {c: 0.5, d: \"\\x01\"}}", "--patch"));
+	stream.str("");
+	{
+		rodb::Dumper dumper(stream, rodb::Dumper::JSON, 4);
+		dumper.dump(patch.root());
+		dumper.dump(patch["b"]["c"]);
+	}
+	BOOST_CHECK(stream.str() == "{\n    \"a\": null,\n    \"b\": {\n        \"c\": 0.5,\n        \"d\": \"\\u0001\"\n    }\n}\n0.5\n");
+	stream.str("");
+	patch.dump_yaml(stream);
+	BOOST_CHECK(stream.str() == "\"a\": ~\n\"b\":\n    \"c\": 0.5\n    \"d\": \"\\x01\"\n");
 }
 
 BOOST_AUTO_TEST_CASE(comparison)
@@ -316,3 +1437,344 @@ BOOST_AUTO_TEST_CASE(direct_database_root_map_access)
 	BOOST_CHECK(db["key3"] == db.root()["key3"]);
 	BOOST_CHECK(db["key4"] == db.root()["key4"]);
 }
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output)
+{
+	char const *sources[] = {
+		"[]",
+		"{}",
+		"[0, 1, 2, 3, 4]",
+		"{key4: 4, key0: 0, key2: 2, key1: 1, key3: 3}",
+		"[false, true, yes, No, 0, 1000, 0x7fffffff, 0xffffffff, 0b101, 017, 1_000, -0, 08, 1:30]",
+		"[0.0, 100.0, -10000.0, 1.5e+3, .5, 3., .inf, -.Inf, 1,000.5]",
+		"[string, \"1_000\", '2', \"\", a b c, \"with\\0zero\", \"<<\", ~x]",
+		"{a: [[0], [1, 2], {b: [c, {d: e}]}], \"quoted key\": 1, dup: 1, dup: 2}",
+		"text: |\n  literal\n  block\nfolded: >\n  folded\n  block\n",
+	};
+
+	for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); ++i)
+	{
+		BOOST_TEST_CHECKPOINT(sources[i]);
+		BOOST_CHECK(read_file(compile_rodb(sources[i])) == compile_native(sources[i]));
+	}
+
+	// Only empty strings, nothing goes into the string pool
+	rodb::Compiler::Options v1;
+	v1.version = 1;
+	BOOST_CHECK(read_file(compile_rodb("[\"\"]", "--v1")) == compile_native("[\"\"]", v1));
+	BOOST_CHECK(read_file(compile_rodb("{\"\": 1, \"\": 2}")) == compile_native("{\"\": 1, \"\": 2}"));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_hash_maps)
+{
+	rodb::Compiler::Options options;
+	options.hash_maps = true;
+
+	std::string const sources[] = {
+		"{}",
+		"{a: {}, b: {c: d}, e: [{f: g}]}",
+		big_map_yaml(300),
+	};
+
+	for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); ++i)
+		BOOST_CHECK(read_file(compile_rodb(sources[i].c_str(), "--hash-maps")) == compile_native(sources[i].c_str(), options));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_eytzinger_maps)
+{
+	rodb::Compiler::Options options;
+	options.eytzinger_maps = true;
+
+	std::string const sources[] = {
+		"{}",
+		"{a: {}, b: {c: d}, e: [{f: g}], abcdefgh1: 0, abcdefgh2: 1}",
+		big_map_yaml(300),
+	};
+
+	for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); ++i)
+		BOOST_CHECK(read_file(compile_rodb(sources[i].c_str(), "--eytzinger-maps")) == compile_native(sources[i].c_str(), options));
+
+	options.hash_maps = true;
+	BOOST_CHECK(read_file(compile_rodb(sources[1].c_str(), "--hash-maps --eytzinger-maps")) == compile_native(sources[1].c_str(), options));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_dedup)
+{
+	rodb::Compiler::Options options;
+	options.dedup = true;
+
+	std::string const sources[] = {
+		"{}",
+		"[a, a, [a, b], [a, b], {a: b}, {a: b}, 1, 1, 1.5, 1.5, true, true]",
+		"{a: [x, {y: z}], b: [x, {y: z}], c: {y: z}, x: a}",
+		big_map_yaml(300),
+	};
+
+	for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); ++i)
+		BOOST_CHECK(read_file(compile_rodb(sources[i].c_str(), "--dedup")) == compile_native(sources[i].c_str(), options));
+
+	options.hash_maps = true;
+	options.eytzinger_maps = true;
+	BOOST_CHECK(read_file(compile_rodb(sources[2].c_str(), "--dedup --hash-maps --eytzinger-maps")) == compile_native(sources[2].c_str(), options));
+}
+
+BOOST_AUTO_TEST_CASE(dedup_db)
+{
+	char const *yaml = "{a: [x, {y: z}, [1, 2]], b: [x, {y: z}, [1, 2]], c: {y: z}, x: a, z: [[1, 2], {y: z}]}";
+	std::vector<char> const plain = read_file(compile_rodb(yaml));
+	DB(db, yaml);
+	rodb::Database dedup_db(compile_rodb(yaml, "--dedup"));
+
+	BOOST_CHECK(read_file(RODB_FILENAME).size() < plain.size());
+	BOOST_CHECK(dedup_db.root() == db.root());
+
+	// Later references point back into the earlier subtrees
+	char const *a = dedup_db["a"][0];
+	char const *z = dedup_db["a"][1]["y"];
+	BOOST_CHECK((char const *)dedup_db["b"][0] == a);
+	BOOST_CHECK((char const *)dedup_db["b"][1]["y"] == z);
+	BOOST_CHECK((char const *)dedup_db["c"]["y"] == z);
+	BOOST_CHECK((char const *)dedup_db["z"][1]["y"] == z);
+	BOOST_CHECK(dedup_db["z"][0] == dedup_db["a"][2]);
+	BOOST_CHECK(dedup_db["x"] == "a");
+
+	rodb::Compiler::Options options;
+	options.dedup = true;
+	rodb::Compiler compiler(options);
+	compiler.parse(yaml);
+	compiler.write_file(RODB_FILENAME);
+	BOOST_CHECK(compiler.statistics().duplicates > 0);
+	BOOST_CHECK(compiler.statistics().output_size + compiler.statistics().saved_bytes == plain.size());
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_inline_scalars)
+{
+	char const *yaml = "[false, true, 0, -1, 8388607, -8388608, 8388608, -8388609, 1.5, 0.1, .inf, '', a, ab, abc, {ab: 1, x: y}]";
+	rodb::Compiler::Options options;
+	options.version = 1;
+
+	BOOST_CHECK(read_file(compile_rodb(yaml)) == compile_native(yaml));
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--v1")) == compile_native(yaml, options));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_packed_arrays)
+{
+	char const *yaml = "{i: [1, 2, 0xffffffff], f: [0.5, .inf], b: [true, no], mixed: [1, true], m: {x: 1, y: 2}, d: [[1, 2], [1, 2]]}";
+	rodb::Compiler::Options options;
+	options.dedup = true;
+
+	BOOST_CHECK(read_file(compile_rodb(yaml)) == compile_native(yaml));
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--dedup")) == compile_native(yaml, options));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_patch)
+{
+	char const *yaml = "{a: ~, b: null, c: {d: ~, e: [1, 2]}, f: '~', g: Null}";
+	rodb::Compiler::Options options;
+	options.patch = true;
+
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--patch")) == compile_native(yaml, options));
+
+	options.version = 1;
+	options.dedup = true;
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--patch --v1 --dedup")) == compile_native(yaml, options));
+
+	BOOST_REQUIRE_EXCEPTION(compile_native("{a: [1, ~]}", options), std::runtime_error, WhatStartsWith("Deletions are only allowed as map values"));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_profile)
+{
+	char const *yaml = "{debug: {tables: [1, 2, 3], names: [aaaa, bbbb]}, player: {speed: 1.5, name: hero, items: [sword, [shield, hero]]}, world: {size: 100, name: hero}}";
+	char const *profile =
+		"  accesses    probes    misses    offset  path\n"
+		"        10        12         0         0  (root)\n"
+		"        10         0         0       312  player.items[1][0]\n"
+		"         5 world\n"
+		"         0 debug\n";
+
+	{
+		std::ofstream out("unit_test.profile");
+		out << profile;
+	}
+
+	std::istringstream in(profile);
+	rodb::Compiler::Options options;
+	options.profile = rodb::Compiler::load_profile(in);
+	BOOST_CHECK(options.profile.size() == 4);
+	BOOST_CHECK(options.profile[""] == 10);
+	BOOST_CHECK(options.profile["world"] == 5);
+
+	std::vector<char> const blob = compile_native(yaml, options);
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--profile unit_test.profile")) == blob);
+	BOOST_CHECK(blob.size() == compile_native(yaml).size());
+
+	// The hot values come first, the cold ones are moved behind them
+	rodb::Database db(write_file(blob), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	DB(plain, yaml);
+	BOOST_CHECK(db.root() == plain.root());
+	char const *shield = db["player"]["items"][1][0];
+	BOOST_CHECK(shield < (char const *)db["player"]["name"]);
+	BOOST_CHECK(shield < (char const *)db["debug"]["names"][0]);
+
+	rodb::Compiler compiler(options);
+	compiler.parse(yaml);
+	compiler.write_file(RODB_FILENAME);
+	BOOST_CHECK(read_file(RODB_FILENAME) == blob);
+
+	options.dedup = true;
+	options.hash_maps = true;
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--profile unit_test.profile --dedup --hash-maps")) == compile_native(yaml, options));
+
+	// Without deduplication aliases are written out every time they're used
+	char const *aliases = "{a: &x {b: [1, c]}, d: *x, e: [*x, *x]}";
+	options = rodb::Compiler::Options();
+	options.profile["e[1].b"] = 1;
+	rodb::Database aliased(write_file(compile_native(aliases, options)), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(read_file(RODB_FILENAME).size() == compile_native(aliases).size());
+	BOOST_CHECK(aliased["e"][1] == aliased["a"]);
+	BOOST_CHECK(aliased["e"][1]["b"][1] == "c");
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_columnar)
+{
+	char const *yaml =
+		"spawns: [{x: 1.5, y: 2, name: orc}, {name: elf, x: 3.5, y: 4}, {x: 5.5, y: 6, name: orc}]\n"
+		"nested: [[{a: {b: 1}}, {a: {b: 2}}], [{a: {b: 1}}, {a: {b: 2}}]]\n"
+		"other: [{p: 1}, {q: 2}, 3]\n";
+
+	rodb::Compiler::Options options;
+	options.columnar = true;
+	std::vector<char> const blob = compile_native(yaml, options);
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--columnar")) == blob);
+
+	rodb::Database db(write_file(blob), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(db["nested"][1].is_table());
+
+	// Merging a table merges its rows
+	char const *aliases = "{list: &list [{p: 1, q: [x]}, {p: 2, q: [y]}], merged: {<<: *list, r: 3}, alias: *list}";
+	rodb::Database merged(write_file(compile_native(aliases, options)), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(merged["list"].is_table());
+	BOOST_CHECK(merged["merged"]["p"] == 1);
+	BOOST_CHECK(merged["merged"]["q"][0] == "x");
+	BOOST_CHECK(merged["alias"] == merged["list"]);
+
+	options.dedup = true;
+	options.eytzinger_maps = true;
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--columnar --dedup --eytzinger-maps")) == compile_native(yaml, options));
+
+	options = rodb::Compiler::Options();
+	options.columnar = true;
+	options.profile["nested[1]"] = 1;
+	options.profile["other"] = 1;
+	{
+		std::ofstream out("unit_test.profile");
+		out << "1 nested[1]\n1 other\n";
+	}
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--columnar --profile unit_test.profile")) == compile_native(yaml, options));
+
+	// Only version 2 has tables, patches never do
+	rodb::Compiler::Options v1;
+	v1.version = 1;
+	options = v1;
+	options.columnar = true;
+	BOOST_CHECK(compile_native(yaml, options) == compile_native(yaml, v1));
+
+	rodb::Compiler::Options patch;
+	patch.patch = true;
+	options = patch;
+	options.columnar = true;
+	BOOST_CHECK(compile_native(yaml, options) == compile_native(yaml, patch));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_same_output_indexes)
+{
+	char const *yaml =
+		"items: [{id: 1, name: a}, {id: 2, name: b}, {name: c}, {id: 1, name: [d]}, 5]\n"
+		"copy: [{id: 1, name: a}, {id: 2, name: b}, {name: c}, {id: 1, name: [d]}, 5]\n"
+		"nested: {list: [{k: x}, {k: y}], <<: {inner: [{k: z}]}}\n"
+		"ints: [1, 2]\n";
+	char const *flags = "--index items:id --index items:name --index nested.list:k --index inner:k --index ints:id";
+
+	rodb::Compiler::Options options;
+	options.indexes["items"].push_back("id");
+	options.indexes["items"].push_back("name");
+	options.indexes["nested.list"].push_back("k");
+	options.indexes["inner"].push_back("k");
+	options.indexes["ints"].push_back("id");
+	std::vector<char> const blob = compile_native(yaml, options);
+	BOOST_CHECK(read_file(compile_rodb(yaml, flags)) == blob);
+
+	rodb::Database db(write_file(blob), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(db["nested"]["list"].find_by("k", "y") == db["nested"]["list"][1]);
+	BOOST_CHECK(db["nested"]["inner"].find_index("k", "z") == 0);
+
+	options.dedup = true;
+	options.hash_maps = true;
+	BOOST_CHECK(read_file(compile_rodb(yaml, (std::string(flags) + " --dedup --hash-maps").c_str())) == compile_native(yaml, options));
+
+	options.columnar = true;
+	BOOST_CHECK(read_file(compile_rodb(yaml, (std::string(flags) + " --dedup --hash-maps --columnar").c_str())) == compile_native(yaml, options));
+
+	options = rodb::Compiler::Options();
+	options.indexes["items"].push_back("id");
+	options.profile["copy"] = 1;
+	{
+		std::ofstream out("unit_test.profile");
+		out << "1 copy\n";
+	}
+	BOOST_CHECK(read_file(compile_rodb(yaml, "--index items:id --profile unit_test.profile")) == compile_native(yaml, options));
+
+	// An alias is indexed where the anchor is
+	char const *aliases = "{a: &list [{id: 1}, {id: 2}], b: *list, c: [{id: 1}, {id: 2}]}";
+	options = rodb::Compiler::Options();
+	options.indexes["a"].push_back("id");
+	rodb::Database anchored(write_file(compile_native(aliases, options)), rodb::Database::READ, rodb::Database::CHECK_ALL);
+	BOOST_CHECK(anchored["b"].find_index("id", 2) == 1);
+	BOOST_CHECK(anchored["b"] == anchored["c"]);
+
+	// Version 1 readers don't know indexed arrays
+	rodb::Compiler::Options v1;
+	v1.version = 1;
+	options = v1;
+	options.indexes["a"].push_back("id");
+	BOOST_CHECK(compile_native(aliases, options) == compile_native(aliases, v1));
+	BOOST_CHECK(read_file(compile_rodb("[{id: 1}, {id: 2}]", "--v1 --index :id")) == compile_native("[{id: 1}, {id: 2}]", v1));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_errors)
+{
+	BOOST_REQUIRE_EXCEPTION(compile_native(""), std::runtime_error, WhatIs("Root object must be either array or map"));
+	BOOST_REQUIRE_EXCEPTION(compile_native("string"), std::runtime_error, WhatIs("Root object must be either array or map"));
+	BOOST_REQUIRE_EXCEPTION(compile_native("]["), std::runtime_error, WhatStartsWith("did not find expected node content"));
+	BOOST_REQUIRE_EXCEPTION(compile_native("[~]"), std::runtime_error, WhatStartsWith("Unsupported type NilClass"));
+	BOOST_REQUIRE_EXCEPTION(compile_native("[2001-01-01]"), std::runtime_error, WhatStartsWith("Unsupported type Time"));
+	BOOST_REQUIRE_EXCEPTION(compile_native("[!!binary aGk=]"), std::runtime_error, WhatStartsWith("Unsupported tag"));
+	BOOST_REQUIRE_EXCEPTION(compile_native("{0: 0}"), std::runtime_error, WhatStartsWith("Map keys should be strings"));
+	BOOST_REQUIRE_EXCEPTION(compile_native("{yes: 0}"), std::runtime_error, WhatStartsWith("Map keys should be strings"));
+	BOOST_REQUIRE_EXCEPTION(compile_native("[*unknown]"), std::runtime_error, WhatStartsWith("Unknown alias"));
+}
+
+BOOST_AUTO_TEST_CASE(native_compiler_aliases_and_merges)
+{
+	char const *yaml =
+		"base: &base {p: 1, q: 2}\n"
+		"other: &other {q: 3, r: 4}\n"
+		"alias: *base\n"
+		"merged: {<<: [*base, *other], p: 0}\n"
+		"overridden: {p: 9, <<: *base}\n";
+
+	rodb::Compiler compiler;
+	compiler.parse(yaml);
+	compiler.write_file(RODB_FILENAME);
+	BOOST_CHECK(compiler.statistics().output_size == compiler.size());
+
+	rodb::Database db(RODB_FILENAME);
+	BOOST_CHECK(db["alias"] == db["base"]);
+
+	BOOST_CHECK(db["merged"].size() == 3);
+	BOOST_CHECK(db["merged"]["p"] == 0);
+	BOOST_CHECK(db["merged"]["q"] == 2);
+	BOOST_CHECK(db["merged"]["r"] == 4);
+
+	BOOST_CHECK(db["overridden"] == db["base"]);
+}
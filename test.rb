@@ -1,6 +1,7 @@
 #!/usr/bin/env ruby
 
 require 'rodb'
+require 'tmpdir'
 require 'test/unit'
 
 class TestYaml2Rodb < Test::Unit::TestCase
@@ -40,6 +41,111 @@ class TestYaml2Rodb < Test::Unit::TestCase
 		assert_compiles "{a: 0, b: 1, c: 2, d: 3, e: 4}"
 	end
 
+	def test_hash_maps
+		plain = Rodb::compile "{a: 0, b: 1}"
+		hashed = Rodb::compile "{a: 0, b: 1}", :hash_maps => true
+		assert hashed.length > plain.length
+		assert hashed.include?("hash")
+		assert_equal Rodb::compile("{}"), Rodb::compile("{}", :hash_maps => true)
+	end
+
+	def test_eytzinger_maps
+		plain = Rodb::compile "{a: 0, b: 1, c: 2}"
+		tree = Rodb::compile "{a: 0, b: 1, c: 2}", :eytzinger_maps => true
+		assert_equal 8 + 4 + 12 * 3, tree.length - plain.length
+		assert tree.end_with?([1, 0, 2].pack('V*'))
+		assert_equal Rodb::compile("{}"), Rodb::compile("{}", :eytzinger_maps => true)
+	end
+
+	def test_dedup
+		yaml = "{a: [x, {y: z}], b: [x, {y: z}], c: x}"
+		plain = Rodb::compile yaml
+		compiler = Rodb::Compiler.new :dedup => true
+		dedup = compiler.compile yaml
+		assert_equal 2, compiler.stats[:duplicates]
+		assert_equal plain.length, dedup.length + compiler.stats[:saved_bytes]
+		assert_equal Rodb::compile("{}"), Rodb::compile("{}", :dedup => true)
+	end
+
+	def test_inline_scalars
+		assert_equal ['B', 1].pack('a1C') + "\0\0", Rodb::compile("[x, true]")[-4..-1]
+		assert_equal [-1 << 8 | 'I'.ord].pack('l<'), Rodb::compile("[x, -1]")[-4..-1]
+		assert_equal "Sab\0", Rodb::compile("[ab]")[-4..-1]
+		assert_equal 8, Rodb::compile("[abc]").length - Rodb::compile("[ab]").length
+		assert_equal 8, Rodb::compile("[abc, 1]", :version => 1).length - Rodb::compile("[abc, 1]").length
+		assert_equal [1].pack('V'), Rodb::compile("[]", :version => 1)[4, 4]
+	end
+
+	def test_packed_arrays
+		assert_equal ['a'.ord | 'i'.ord << 8, 16, 3, 1, 2, -3].pack('V3l<3'), Rodb::compile("[1, 2, -3]")[8..-1]
+		assert_equal ['a'.ord | 'b'.ord << 8, 6, 2, 1, 0].pack('V3C2'), Rodb::compile("[true, false]")[8..-1]
+		assert_equal ['a'.ord | 'f'.ord << 8, 8, 1, 0.5].pack('V3e'), Rodb::compile("[0.5]")[8..-1]
+		assert_equal 'a', Rodb::compile("[1, 1.5]")[8]
+		assert_equal 'a', Rodb::compile("[1, 2]", :version => 1)[8]
+	end
+
+	def test_patch
+		assert_doesnt_compile "{a: ~}"
+		assert_equal ['D'.ord].pack('V'), Rodb::compile("{a: ~}", :patch => true)[-4..-1]
+		assert_equal ['d', 4, 0].pack('a4VV'), Rodb::compile("{a: ~}", :patch => true, :version => 1)[-12..-1]
+		assert_raise(RuntimeError) { Rodb::compile "{a: [1, ~]}", :patch => true }
+	end
+
+	def test_profile
+		profile = Rodb.load_profile "  accesses    probes    misses    offset  path\n         3         0         0        64  hot\n 2 (root)\n"
+		assert_equal({'hot' => 3, '' => 2}, profile)
+
+		yaml = "{cold: [aaaa], hot: bbbb}"
+		blob = Rodb::compile yaml, :profile => profile
+		assert_equal Rodb::compile(yaml).length, blob.length
+		assert blob.index('bbbb') < blob.index('aaaa')
+	end
+
+	def test_columnar
+		table = Rodb::compile "[{a: 1, b: x}, {b: y, a: 2}]", :columnar => true
+		assert_equal ['a'.ord | 'm'.ord << 8, 2].pack('V2'), [table[8, 4], table[16, 4]].join
+		assert_equal ['a'.ord | 'i'.ord << 8, 12, 2, 1, 2].pack('V5'), table[72, 20]
+		assert_equal 'a', Rodb::compile("[{a: 1}, {b: 2}]", :columnar => true)[8]
+		assert_equal 'a', Rodb::compile("[{a: 1}]", :columnar => true)[8]
+		assert_equal 'a', Rodb::compile("[{a: 1}, {a: 2}]", :columnar => true, :version => 1)[8]
+		assert_equal Rodb::compile("[{a: ~}, {a: ~}]", :patch => true), Rodb::compile("[{a: ~}, {a: ~}]", :columnar => true, :patch => true)
+	end
+
+	def test_indexes
+		plain = Rodb::compile "[{id: 1}, {id: 2}]"
+		indexed = Rodb::compile "[{id: 1}, {id: 2}]", :indexes => {'' => ['id']}
+		assert_equal ['a'.ord | 0x10000].pack('V'), indexed[8, 4]
+		assert_equal 8 + 4 + 4 + 4 + 8 * 4 + 4, indexed.length - plain.length
+		assert_equal [indexed.length - plain.length - 4].pack('V'), indexed[-4..-1]
+		assert_equal Rodb::compile("[1, 2]"), Rodb::compile("[1, 2]", :indexes => {'' => ['id']})
+		assert_equal plain, Rodb::compile("[{id: 1}, {id: 2}]", :indexes => {'a' => ['id']})
+	end
+
+	def test_cache
+		Dir.mktmpdir do |dir|
+			big = (0...300).map { |i| "item#{i}" }
+			yaml = {'big' => big, 'other' => {'deep' => big.reverse}, 'small' => [1, 'x']}.to_yaml
+			edited = yaml.sub 'item7', 'changed'
+
+			[{}, {:hash_maps => true, :columnar => true}, {:dedup => true}].each do |options|
+				compiler = Rodb::Compiler.new options.merge(:cache => dir)
+				assert_equal Rodb::compile(yaml, options), compiler.compile(yaml)
+				assert_equal 0, compiler.stats[:cached_bytes]
+				assert_equal Rodb::compile(yaml, options), compiler.compile(yaml)
+				assert_equal Rodb::compile(yaml, options).length, compiler.stats[:cached_bytes]
+
+				# Only the edited subtree and its parents are compiled again
+				assert_equal Rodb::compile(edited, options), compiler.compile(edited)
+				assert_equal(options[:dedup] ? 0 : Rodb::compile({'deep' => big.reverse}.to_yaml, options).length - 8, compiler.stats[:cached_bytes])
+			end
+		end
+	end
+
+	def test_hash_key
+		assert_equal 2166136261, Rodb::hash_key("")
+		assert_equal 0xe40c292c, Rodb::hash_key("a")
+	end
+
 	def test_map_string_keys
 		assert_doesnt_compile "{0: 0}"
 		assert_doesnt_compile "{0: 0, 1: 1, 2: 2}" # all numbers
@@ -0,0 +1,118 @@
+#include "Compiler.h"
+
+#include <iomanip>
+
+namespace
+{
+
+void print_usage()
+{
+	std::cerr
+		<< "Usage: yaml2rodb [options] input.yaml output.rodb\n"
+		<< "    --stats           print compilation statistics\n"
+		<< "    --hash-maps       emit hash tables for maps\n"
+		<< "    --eytzinger-maps  emit key prefixes in Eytzinger order for maps\n"
+		<< "    --dedup           store identical strings and subtrees only once\n"
+		<< "    --patch           compile an overlay patch, null values delete keys\n"
+		<< "    --columnar        store arrays of maps with the same keys column by column\n"
+		<< "    --v1              write format version 1, readable by older readers\n"
+		<< "    --index PATH:FIELD  index the maps of the array at PATH by FIELD (see rodb::Value::find_by)\n"
+		<< "    --profile FILE    write the hot paths listed in FILE (see rodb::Profile::dump) first\n";
+}
+
+double per_second(double amount, double seconds)
+{
+	return seconds > 0 ? amount / seconds : 0;
+}
+
+void print_statistics(rodb::Compiler::Statistics const &s)
+{
+	double const mb = 1024.0 * 1024.0;
+	double const total_seconds = s.parse_seconds + s.write_seconds;
+
+	std::cout
+		<< std::fixed << std::setprecision(3)
+		<< "      Nodes: " << s.nodes << "\n"
+		<< " Input size: " << s.input_size / mb << " MB\n"
+		<< "Output size: " << s.output_size / mb << " MB\n"
+		<< " Duplicates: " << s.duplicates << ", "
+			<< s.saved_bytes / mb << " MB saved\n"
+		<< " Parse time: " << s.parse_seconds << " s, "
+			<< per_second(s.nodes, s.parse_seconds) << " nodes/s, "
+			<< per_second(s.input_size / mb, s.parse_seconds) << " MB/s\n"
+		<< " Write time: " << s.write_seconds << " s, "
+			<< per_second(s.nodes, s.write_seconds) << " nodes/s, "
+			<< per_second(s.output_size / mb, s.write_seconds) << " MB/s\n"
+		<< " Total time: " << total_seconds << " s, "
+			<< per_second(s.nodes, total_seconds) << " nodes/s, "
+			<< per_second(s.input_size / mb, total_seconds) << " MB/s\n";
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	bool stats = false;
+	char const *profile = 0;
+	rodb::Compiler::Options options;
+	std::vector<char const *> files;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--stats") == 0)
+			stats = true;
+		else if (strcmp(argv[i], "--hash-maps") == 0)
+			options.hash_maps = true;
+		else if (strcmp(argv[i], "--eytzinger-maps") == 0)
+			options.eytzinger_maps = true;
+		else if (strcmp(argv[i], "--dedup") == 0)
+			options.dedup = true;
+		else if (strcmp(argv[i], "--patch") == 0)
+			options.patch = true;
+		else if (strcmp(argv[i], "--columnar") == 0)
+			options.columnar = true;
+		else if (strcmp(argv[i], "--v1") == 0)
+			options.version = 1;
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			profile = argv[++i];
+		else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc && strrchr(argv[i + 1], ':'))
+		{
+			std::string index = argv[++i];
+			size_t colon = index.rfind(':');
+			options.indexes[index.substr(0, colon)].push_back(index.substr(colon + 1));
+		}
+		else
+			files.push_back(argv[i]);
+	}
+
+	if (files.size() != 2)
+	{
+		print_usage();
+		return 1;
+	}
+
+	try
+	{
+		if (profile)
+		{
+			std::ifstream in(profile);
+			if (in.fail())
+				throw std::runtime_error("Cannot open profile");
+
+			options.profile = rodb::Compiler::load_profile(in);
+		}
+
+		rodb::Compiler compiler(options);
+		compiler.parse_file(files[0]);
+		compiler.write_file(files[1]);
+
+		if (stats)
+			print_statistics(compiler.statistics());
+	}
+	catch (std::exception const &e)
+	{
+		std::cerr << files[0] << ": " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
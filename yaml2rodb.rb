@@ -2,7 +2,39 @@
 
 require File.join(File.dirname(__FILE__), 'rodb')
 
+options = {}
+options[:hash_maps] = true if ARGV.delete '--hash-maps'
+options[:eytzinger_maps] = true if ARGV.delete '--eytzinger-maps'
+options[:dedup] = true if ARGV.delete '--dedup'
+options[:patch] = true if ARGV.delete '--patch'
+options[:columnar] = true if ARGV.delete '--columnar'
+options[:version] = 1 if ARGV.delete '--v1'
+if profile = ARGV.index('--profile')
+	options[:profile] = Rodb.load_profile File.read(ARGV[profile + 1])
+	ARGV.slice! profile, 2
+end
+if cache = ARGV.index('--cache')
+	options[:cache] = ARGV[cache + 1]
+	ARGV.slice! cache, 2
+end
+while index = ARGV.index('--index')
+	path, _, field = ARGV[index + 1].rpartition ':'
+	((options[:indexes] ||= {})[path] ||= []) << field
+	ARGV.slice! index, 2
+end
+stats = ARGV.delete '--stats'
+
 # TODO: Catch exceptions here and report errors to the user!
+compiler = Rodb::Compiler.new options
+blob = File.open(ARGV[0]) { |file| compiler.compile file }
+
 File.open ARGV[1], "wb" do |file|
-	file.write Rodb::compile_file(ARGV[0])
+	file.write blob
+end
+
+if stats
+	puts " Output size: #{blob.length}"
+	puts "  Duplicates: #{compiler.stats[:duplicates]}"
+	puts " Saved bytes: #{compiler.stats[:saved_bytes]} (#{'%.1f' % (100.0 * compiler.stats[:saved_bytes] / (blob.length + compiler.stats[:saved_bytes]))}%)"
+	puts "Cached bytes: #{compiler.stats[:cached_bytes]}" if options[:cache]
 end